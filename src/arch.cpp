@@ -0,0 +1,76 @@
+// one copy of the whole engine, compiled once per instruction set with TDCHESS_ARCH naming the
+// namespace it lives in, see dispatch.cpp for how the copy is picked at startup
+
+// system and third party headers are included at global scope first, so their include guards
+// keep them out of the namespace below, extend this list when the engine includes a new one
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <bitset>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <immintrin.h>
+#include <iomanip>
+#include <iostream>
+#include <istream>
+#include <iterator>
+#include <limits.h>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <queue>
+#include <random>
+#include <sched.h>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "../lib/Fathom/src/tbprobe.h"
+#include "hpplib/incbin.h"
+
+namespace TDCHESS_ARCH
+{
+
+#include "engine/uci.h"
+
+int run(int argc, char **argv)
+{
+    std::vector<std::string> args{argv + 1, argv + argc};
+
+    uci_handler handler{};
+    handler.loop(args);
+
+    return 0;
+}
+
+} // namespace TDCHESS_ARCH
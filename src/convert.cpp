@@ -0,0 +1,26 @@
+// converts a network in the old int16 layout to the int8 format, the build runs it on
+// nets/motor.bin when TDCHESS_EMBED_INT8 asks for the int8 net to be embedded
+// usage: tdchess_convert <in.bin> <out.bin>
+
+#include "engine/nnue2.h"
+
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: tdchess_convert <in.bin> <out.bin>" << std::endl;
+        return 1;
+    }
+
+    nnue2::network_view network{};
+    if (!network.load_network(argv[1]) || !network.save(argv[2]))
+    {
+        std::cout << "info string convert failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "info string convert " << argv[1] << " to " << argv[2] << " done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,72 @@
+// entry point of the multi instruction set build, runs the best engine copy this cpu supports
+// TDCHESS_ISA=<name> in the environment forces a lower one, for testing
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace isa_avx512_vnni
+{
+int run(int argc, char **argv);
+}
+namespace isa_avx512
+{
+int run(int argc, char **argv);
+}
+namespace isa_avx2_bmi2
+{
+int run(int argc, char **argv);
+}
+namespace isa_avx2
+{
+int run(int argc, char **argv);
+}
+namespace isa_sse41
+{
+int run(int argc, char **argv);
+}
+
+struct isa_entry
+{
+    const char *name;
+    bool supported;
+    int (*run)(int, char **);
+};
+
+int main(int argc, char **argv)
+{
+    __builtin_cpu_init();
+
+    const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    const bool avx512 = avx2 && __builtin_cpu_supports("avx512f") &&
+                        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2");
+
+    // best first
+    const isa_entry entries[] = {
+        {"avx512-vnni", avx512 && __builtin_cpu_supports("avx512vnni"), isa_avx512_vnni::run},
+        {"avx512", avx512, isa_avx512::run},
+        {"avx2-bmi2", avx2 && __builtin_cpu_supports("bmi2"), isa_avx2_bmi2::run},
+        {"avx2", avx2, isa_avx2::run},
+        {"sse4.1", __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt"),
+         isa_sse41::run},
+    };
+
+    const char *forced = std::getenv("TDCHESS_ISA");
+    if (forced != nullptr && *forced == '\0')
+        forced = nullptr;
+    for (const auto &entry : entries)
+    {
+        if (!entry.supported)
+            continue;
+
+        if (forced != nullptr && std::strcmp(forced, entry.name) != 0)
+            continue;
+
+        return entry.run(argc, argv);
+    }
+
+    std::cout << "info string no supported instruction set"
+              << (forced != nullptr ? " matches TDCHESS_ISA" : ", needs at least sse4.1")
+              << std::endl;
+    return 1;
+}
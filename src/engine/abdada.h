@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// positions some search thread is inside of right now, abdada style, so the others can search
+// them later or shallower instead of doing the same work at the same time
+// only nodes near the root are entered, racy by design since a wrong answer only costs time
+struct busy_table
+{
+    struct entry
+    {
+        std::atomic<uint64_t> key = 0;
+        std::atomic<int32_t> depth = 0;
+        // -1 when free
+        std::atomic<int32_t> owner = -1;
+    };
+
+    static constexpr size_t SIZE = 1 << 12;
+    static constexpr size_t MASK = SIZE - 1;
+    // only nodes above this ply are entered
+    static constexpr int MAX_PLY = 8;
+
+    entry entries[SIZE];
+
+    // true when a thread other than [thread] is searching [key] at [depth] or deeper
+    bool is_busy(uint64_t key, int depth, int thread) const
+    {
+        const entry &slot = entries[key & MASK];
+        const int owner = slot.owner.load(std::memory_order_relaxed);
+        return owner >= 0 && owner != thread && slot.key.load(std::memory_order_relaxed) == key &&
+               slot.depth.load(std::memory_order_relaxed) >= depth;
+    }
+
+    // marks a position as busy for its lifetime, unless the slot is taken
+    class holder
+    {
+        entry *m_held = nullptr;
+
+      public:
+        holder(busy_table *table, uint64_t key, int depth, int ply, int thread)
+        {
+            if (table == nullptr || ply >= MAX_PLY)
+                return;
+
+            entry &slot = table->entries[key & MASK];
+            if (slot.owner.load(std::memory_order_relaxed) >= 0)
+                return;
+
+            slot.key.store(key, std::memory_order_relaxed);
+            slot.depth.store(depth, std::memory_order_relaxed);
+            slot.owner.store(thread, std::memory_order_relaxed);
+            m_held = &slot;
+        }
+
+        holder(const holder &) = delete;
+        holder &operator=(const holder &) = delete;
+
+        ~holder()
+        {
+            if (m_held != nullptr)
+                m_held->owner.store(-1, std::memory_order_relaxed);
+        }
+    };
+};
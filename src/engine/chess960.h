@@ -1,5 +1,6 @@
 #pragma once
 
+#include "numa.h"
 #include <cinttypes>
 
 namespace global
@@ -8,4 +9,22 @@ inline bool chess_960 = false;
 
 // uh i'm just using this for ease
 inline int16_t contempt = 0;
+
+// back the tt and per thread search state with huge pages when possible
+inline bool large_pages = true;
+
+// where search threads, their state and the tt live on multi socket machines, off by default so
+// threads keep the affinity the process was started with
+inline numa::policy numa_policy = numa::policy::NONE;
+
+// qsearch stands pat on the incremental pesto score when it clears beta by lazy_margin, without
+// running the network
+inline bool lazy_eval = false;
+inline int16_t lazy_margin = 400;
+
+// search threads reduce moves another thread is already searching, see busy_table
+inline bool abdada = false;
+
+// prints the eval cache and lazy evaluation counters after each search, for debugging
+inline bool eval_stats = false;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "chess.h"
+#include "kernels.h"
 #include "param.h"
 #include "simd.h"
 #include <cinttypes>
@@ -8,12 +9,6 @@
 #include <iostream>
 #include <vector>
 
-#if defined(__AVX2__)
-#include <immintrin.h>
-#else
-#include <arm_neon.h>
-#endif
-
 namespace chessmap
 {
 
@@ -25,7 +20,11 @@ constexpr int SCALE = 10000;
 
 #define INCBIN_SILENCE_BITCODE_WARNING
 #include "../hpplib/incbin.h"
+#ifdef TDCHESS_EXTERN_NETS
+INCBIN_EXTERN(Chessmap);
+#else
 INCBIN(Chessmap, "../nets/chessmap/chessmap_1.9.15.bin");
+#endif
 
 struct network
 {
@@ -36,38 +35,21 @@ struct network
     int16_t output_bias[OUTPUTS];
 };
 
-struct update
-{
-    chess::Square king_sq[2];
-
-    std::pair<chess::Square, chess::Piece> add1;
-    std::pair<chess::Square, chess::Piece> add2;
-    std::pair<chess::Square, chess::Piece> sub1;
-    std::pair<chess::Square, chess::Piece> sub2;
-
-    enum
-    {
-        MOVE,
-        CAPTURE,
-        CASTLE
-    } type;
-};
-
 struct accumulator
 {
     alignas(64) int16_t vals[2][HL];
 
+    // by from square relative to the side to move, valid after [evaluate_all] at this ply
     int16_t outputs[OUTPUTS];
-    bool outputs_cached[OUTPUTS];
-
-    bool is_clean[2];
-    update up;
 };
 
 class net
 {
     network m_network{};
-    accumulator m_side[param::MAX_DEPTH]{};
+    // by kernels::ring_slot of the ply, like nnue2 only the top plies are kept
+    accumulator m_side[kernels::RING]{};
+    kernels::update m_updates[param::MAX_DEPTH]{};
+    kernels::ring_owners m_owners{};
     int m_head{0};
 
   public:
@@ -94,85 +76,9 @@ class net
         assert(m_head < param::MAX_DEPTH);
 
         m_head++;
-        m_side[m_head].is_clean[0] = m_side[m_head].is_clean[1] = false;
-        auto *update = &m_side[m_head].up;
-
-        memset(m_side[m_head].outputs_cached, 0, sizeof(m_side[m_head].outputs_cached));
-
-        // new king pos
-        update->king_sq[0] = board.kingSq(chess::Color::WHITE);
-        update->king_sq[1] = board.kingSq(chess::Color::BLACK);
-        if (board.at(move.from()).type() == chess::PieceType::KING)
-        {
-            // check castle
-            if (move.typeOf() == chess::Move::CASTLING)
-            {
-                const bool king_side = move.to() > move.from();
-                const chess::Square king_to =
-                    chess::Square::castling_king_square(king_side, board.sideToMove());
-                update->king_sq[board.sideToMove()] = king_to;
-            }
-            else
-            {
-                update->king_sq[board.sideToMove()] = move.to();
-            }
-        }
-
-        chess::Piece from = board.at(move.from());
-        chess::Piece to = board.at(move.to());
-        bool is_capture = to != chess::Piece::NONE;
-        update->type = update::MOVE;
-        switch (move.typeOf())
-        {
-        case chess::Move::NORMAL: {
-            update->add1 = {move.to(), from};
-            update->sub1 = {move.from(), from};
-
-            if (is_capture)
-            {
-                update->type = update::CAPTURE;
-                update->sub2 = {move.to(), to};
-            }
-            break;
-        }
-        case chess::Move::ENPASSANT: {
-            update->type = update::CAPTURE;
-
-            update->add1 = {move.to(), from};
-            update->sub1 = {move.from(), from};
-
-            update->sub2 = {move.to().ep_square(), board.at(move.to().ep_square())};
-            break;
-        }
-        case chess::Move::PROMOTION: {
-            update->add1 = {move.to(), chess::Piece{board.sideToMove(), move.promotionType()}};
-            update->sub1 = {move.from(), from};
-
-            if (is_capture)
-            {
-                update->type = update::CAPTURE;
-                update->sub2 = {move.to(), to};
-            }
-            break;
-        }
-        case chess::Move::CASTLING: {
-            const bool king_side = move.to() > move.from();
-            const chess::Square rook_to =
-                chess::Square::castling_rook_square(king_side, board.sideToMove());
-            const chess::Square king_to =
-                chess::Square::castling_king_square(king_side, board.sideToMove());
-
-            update->type = update::CASTLE;
-            update->add1 = {king_to, from};
-            update->sub1 = {move.from(), from};
-
-            update->add2 = {rook_to, to};
-            update->sub2 = {move.to(), to};
-            break;
-        }
-        default:
-            assert(false);
-        }
+        m_owners.release(m_head, 0);
+        m_owners.release(m_head, 1);
+        kernels::record(m_updates[m_head], board, move);
     }
 
     void unmake_move()
@@ -180,66 +86,63 @@ class net
         m_head--;
     }
 
-    void catchup(const chess::Board &_)
+    void catchup(const chess::Board &position)
     {
+        kernels::catchup_job<int16_t> jobs[2];
+        int num_jobs = 0;
+
         for (int side = 0; side <= 1; ++side)
         {
-            if (m_side[m_head].is_clean[side])
+            if (m_owners.holds(m_head, side))
                 continue;
 
             int base = m_head;
             while (true)
             {
-                if (m_side[base].is_clean[side])
+                if (base < 0 || m_head - base > kernels::MAX_CATCHUP)
+                {
+                    refresh(position, side, m_head);
+                    break;
+                }
+
+                if (m_owners.holds(base, side))
                 {
-                    for (int i = base + 1; i <= m_head; ++i)
-                    {
-                        update((simd::Vec *)m_side[i - 1].vals[side],
-                               (simd::Vec *)m_side[i].vals[side], m_side[i].up, side);
-                        m_side[i].is_clean[side] = true;
-                    }
-
-                    assert(m_side[m_head].is_clean[side]);
+                    collect(jobs[num_jobs++], static_cast<chess::Color>(side), base);
                     break;
                 }
 
                 base -= 1;
-                assert(base >= 0);
             }
         }
 
-        assert(m_side[m_head].is_clean[0] && m_side[m_head].is_clean[1]);
+        // int16 rows are used unscaled
+        if (num_jobs > 0)
+            kernels::fused_catchup<HL>(jobs, num_jobs, simd::Vec{});
+
+        assert(m_owners.holds(m_head, 0) && m_owners.holds(m_head, 1));
     }
 
-    void update(simd::Vec *__restrict__ base, simd::Vec *__restrict__ next, const update &update,
-                chess::Color side)
+    void collect(kernels::catchup_job<int16_t> &job, chess::Color side, int base)
     {
-        switch (update.type)
+        job.in = (const simd::Vec *)m_side[kernels::ring_slot(base)].vals[side];
+        job.plies = m_head - base;
+
+        for (int p = 0; p < job.plies; ++p)
         {
-        case update::MOVE: {
-            fused_add_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first));
-            break;
-        }
-        case update::CAPTURE: {
-            fused_add_sub_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first),
-                feature_lookup(update.king_sq[side], side, update.sub2.second, update.sub2.first));
-            break;
-        }
-        case update::CASTLE: {
-            fused_add_add_sub_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.add2.second, update.add2.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first),
-                feature_lookup(update.king_sq[side], side, update.sub2.second, update.sub2.first));
-            break;
-        }
+            const int ply = base + 1 + p;
+            kernels::push_rows(job, p, m_updates[ply], side,
+                               [&](chess::Square king_sq, chess::Color s, chess::Piece piece,
+                                   chess::Square sq) {
+                                   return feature_lookup(king_sq, s, piece, sq);
+                               });
+
+            // same as nnue2, only the head and its parent are written back
+            const bool keep = p >= job.plies - 2;
+            job.outs[p] = keep ? (simd::Vec *)m_side[kernels::ring_slot(ply)].vals[side] : nullptr;
+            if (keep)
+                m_owners.claim(ply, side);
+            else
+                m_owners.release(ply, side);
         }
     }
 
@@ -248,170 +151,72 @@ class net
         int32_t result;
         if (ref.sideToMove() == chess::Color::BLACK)
         {
-            result = (int)m_side[m_head].outputs[move.from().index() ^ 56];
+            result = (int)head().outputs[move.from().index() ^ 56];
         }
         else
         {
-            result = (int)m_side[m_head].outputs[move.from().index()];
+            result = (int)head().outputs[move.from().index()];
         }
 
         return std::clamp(result, 0, SCALE);
     }
 
-    int32_t evaluate_cached(const chess::Board &ref, chess::Move move)
+    // catches up and fills the outputs of every from square for the head, called once by
+    // nodes that order quiets, [get_output] then reads them per move
+    void evaluate_all(const chess::Board &ref)
     {
-        assert(m_side[m_head].is_clean[0]);
+        catchup(ref);
 
-#if defined(__AVX2__)
-        const __m256i *__restrict__ us = (__m256i *)(m_side[m_head].vals[ref.sideToMove()]);
-        const __m256i *__restrict__ them = (__m256i *)(m_side[m_head].vals[ref.sideToMove() ^ 1]);
-#else
-        const int16x8_t *__restrict__ us = (int16x8_t *)(m_side[m_head].vals[ref.sideToMove()]);
-        const int16x8_t *__restrict__ them =
-            (int16x8_t *)(m_side[m_head].vals[ref.sideToMove() ^ 1]);
-#endif
-        int bucket_from = move.from().index();
+        auto &acc = head();
+        const int16_t *us = acc.vals[ref.sideToMove()];
+        const int16_t *them = acc.vals[ref.sideToMove() ^ 1];
 
-        if (ref.sideToMove() == chess::Color::BLACK)
-        {
-            bucket_from ^= 56;
-        }
+        alignas(64) int32_t sums[OUTPUTS];
+        kernels::screlu_gemv<QA, HL, OUTPUTS>(us, them, &m_network.output_weights[0][0], sums);
 
-        if (!m_side[m_head].outputs_cached[bucket_from])
+        for (int bucket = 0; bucket < OUTPUTS; ++bucket)
         {
-            m_side[m_head].outputs_cached[bucket_from] = true;
-
-#if defined(__AVX2__)
-            const __m256i *__restrict__ us_weights =
-                (__m256i *)(m_network.output_weights[bucket_from]);
-            const __m256i *__restrict__ them_weights =
-                (__m256i *)(m_network.output_weights[bucket_from] + HL);
-#else
-            const int16x8_t *__restrict__ us_weights =
-                (int16x8_t *)(m_network.output_weights[bucket_from]);
-            const int16x8_t *__restrict__ them_weights =
-                (int16x8_t *)(m_network.output_weights[bucket_from] + HL);
-#endif
-            int32_t output = flatten(us, us_weights) + flatten(them, them_weights);
+            int32_t output = sums[bucket];
 
             output /= QA;
-            output += m_network.output_bias[bucket_from];
+            output += m_network.output_bias[bucket];
 
             output *= SCALE;
             output /= QA * QB;
 
-            m_side[m_head].outputs[bucket_from] = output;
-        }
-
-        return get_output(ref, move);
-    }
-
-#if defined(__AVX2__)
-    int32_t flatten(const __m256i *__restrict__ acc, const __m256i *__restrict__ weight)
-    {
-        const __m256i vec_zero = _mm256_setzero_si256();
-        const __m256i vec_qa = _mm256_set1_epi16(QA);
-
-        __m256i sum = vec_zero;
-
-        // HL / 16 gives us the total number of __m256i blocks.
-        // We process 2 blocks (32 elements) per iteration.
-        for (int i = 0; i < (HL / 16); i += 2)
-        {
-            // Prefetching next blocks
-            _mm_prefetch((const char *)&acc[i + 2], _MM_HINT_T0);
-            _mm_prefetch((const char *)&weight[i + 2], _MM_HINT_T0);
-
-            // Load 256-bit vectors via pointer dereference
-            const __m256i us = acc[i + 0];
-            const __m256i them = acc[i + 1];
-            const __m256i us_weights = weight[i + 0];
-            const __m256i them_weights = weight[i + 1];
-
-            // Clamp: min(max(x, 0), QA)
-            const __m256i us_clamped = _mm256_min_epi16(_mm256_max_epi16(us, vec_zero), vec_qa);
-            const __m256i them_clamped = _mm256_min_epi16(_mm256_max_epi16(them, vec_zero), vec_qa);
-
-            // Compute: (weight * clamped) then horizontal-multiply-add with clamped
-            // This effectively computes sum(weight * clamped^2) widened to 32-bit
-            const __m256i us_results =
-                _mm256_madd_epi16(_mm256_mullo_epi16(us_weights, us_clamped), us_clamped);
-            const __m256i them_results =
-                _mm256_madd_epi16(_mm256_mullo_epi16(them_weights, them_clamped), them_clamped);
-
-            sum = _mm256_add_epi32(sum, us_results);
-            sum = _mm256_add_epi32(sum, them_results);
-        }
-
-        // Final horizontal reduction: 256-bit -> 128-bit -> scalar int32
-        __m128i v_low = _mm256_castsi256_si128(sum);
-        __m128i v_high = _mm256_extracti128_si256(sum, 1);
-        __m128i res = _mm_add_epi32(v_low, v_high);
-
-        // Collapse 4x32-bit into 1x32-bit
-        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(0, 1, 2, 3)));
-        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 0, 1)));
-
-        return _mm_cvtsi128_si32(res);
-    }
-#else
-    int32_t flatten(const int16x8_t *__restrict__ acc, const int16x8_t *__restrict__ weight)
-    {
-        const int16x8_t v_zero = vdupq_n_s16(0);
-        const int16x8_t v_qa = vdupq_n_s16(QA);
-
-        int32x4_t out0 = vdupq_n_s32(0);
-        int32x4_t out1 = vdupq_n_s32(0);
-        int32x4_t out2 = vdupq_n_s32(0);
-        int32x4_t out3 = vdupq_n_s32(0);
-
-        for (int i = 0; i < HL / 8; i += 2)
-        {
-            __builtin_prefetch(&acc[i + 2]);
-            __builtin_prefetch(&weight[i + 2]);
-
-            int16x8_t c0 = vminq_s16(vmaxq_s16(acc[i + 0], v_zero), v_qa);
-            int16x8_t c1 = vminq_s16(vmaxq_s16(acc[i + 1], v_zero), v_qa);
-
-            int16x8_t pm0 = vmulq_s16(c0, weight[i + 0]);
-            int16x8_t pm1 = vmulq_s16(c1, weight[i + 1]);
-
-            out0 = vmlal_s16(out0, vget_low_s16(pm0), vget_low_s16(c0));
-            out1 = vmlal_s16(out1, vget_low_s16(pm1), vget_low_s16(c1));
-            out2 = vmlal_high_s16(out2, pm0, c0);
-            out3 = vmlal_high_s16(out3, pm1, c1);
+            acc.outputs[bucket] = output;
         }
-
-        return vaddvq_s32(vaddq_s32(vaddq_s32(out0, out1), vaddq_s32(out2, out3)));
     }
-#endif
 
     void initialize(const chess::Board &position)
     {
         m_head = 0;
-        m_side[0].up.king_sq[0] = position.kingSq(chess::Color::WHITE);
-        m_side[0].up.king_sq[1] = position.kingSq(chess::Color::BLACK);
+        m_updates[0].king_sq[0] = position.kingSq(chess::Color::WHITE);
+        m_updates[0].king_sq[1] = position.kingSq(chess::Color::BLACK);
 
-        // refresh head
-        fused_copy<HL>((simd::Vec *)m_side[m_head].vals[0], (simd::Vec *)m_network.feature_bias);
-        fused_copy<HL>((simd::Vec *)m_side[m_head].vals[1], (simd::Vec *)m_network.feature_bias);
+        refresh(position, chess::Color::WHITE, 0);
+        refresh(position, chess::Color::BLACK, 0);
+    }
 
-        memset(m_side[m_head].outputs_cached, 0, sizeof(m_side[m_head].outputs_cached));
+    // rebuilds [side] of ply [index] from the bias
+    void refresh(const chess::Board &position, chess::Color side, int index)
+    {
+        auto &acc = m_side[kernels::ring_slot(index)];
+        kernels::fused_copy<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)m_network.feature_bias);
 
         auto occ = position.occ();
         while (occ)
         {
             auto sq = occ.pop();
-            acc_add_piece(m_side[m_head], 0, position.kingSq(0), position.at(sq), sq);
-            acc_add_piece(m_side[m_head], 1, position.kingSq(1), position.at(sq), sq);
+            acc_add_piece(acc, side, position.kingSq(side), position.at(sq), sq);
         }
 
-        m_side[m_head].is_clean[0] = m_side[m_head].is_clean[1] = true;
+        m_owners.claim(index, side);
     }
 
     void show_evaluation(const chess::Board &position) const
     {
-        auto *result = m_side[m_head].outputs;
+        auto *result = head().outputs;
         std::cout << "Start Square\n";
         for (int i = 0; i < 64; ++i)
         {
@@ -433,69 +238,35 @@ class net
         // }
     }
 
-  private:
-    simd::Vec *feature_lookup(chess::Square _, chess::Color side, chess::Piece piece,
-                              chess::Square square)
-    {
-        return reinterpret_cast<simd::Vec *>(
-            m_network.feature_weights[((piece.color() == side ? 0 : 6) + piece.type()) * 64 +
-                                      square.relative_square(side).index()]);
-    }
-
-    void acc_add_piece(accumulator &acc, chess::Color side, chess::Square king_sq,
-                       chess::Piece piece, chess::Square square)
-    {
-        fused_add<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
-                      feature_lookup(king_sq, side, piece, square));
-    }
-
-    /// fused updates ///
-
-    template <size_t Size>
-    static void fused_copy(simd::Vec *__restrict__ out, const simd::Vec *__restrict__ in)
+    // per thread bytes of the accumulator stack
+    size_t stack_bytes() const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = in[i];
+        return sizeof(m_side) + sizeof(m_updates) + sizeof(m_owners);
     }
 
-    template <size_t Size>
-    static void fused_add(simd::Vec *out, const simd::Vec *in, const simd::Vec *add)
-    {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::add16(in[i], add[i]);
-    }
-
-    template <size_t Size>
-    static void fused_sub(simd::Vec *out, const simd::Vec *in, const simd::Vec *sub)
+  private:
+    accumulator &head()
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(in[i], sub[i]);
+        return m_side[kernels::ring_slot(m_head)];
     }
 
-    template <size_t Size>
-    static void fused_add_sub(simd::Vec *out, const simd::Vec *in, const simd::Vec *add,
-                              const simd::Vec *sub)
+    const accumulator &head() const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(simd::add16(in[i], add[i]), sub[i]);
+        return m_side[kernels::ring_slot(m_head)];
     }
 
-    template <size_t Size>
-    static void fused_add_sub_sub(simd::Vec *out, const simd::Vec *in, const simd::Vec *add,
-                                  const simd::Vec *sub1, const simd::Vec *sub2)
+    const int16_t *feature_lookup(chess::Square _, chess::Color side, chess::Piece piece,
+                                  chess::Square square) const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(simd::sub16(simd::add16(in[i], add[i]), sub1[i]), sub2[i]);
+        return m_network.feature_weights[((piece.color() == side ? 0 : 6) + piece.type()) * 64 +
+                                         square.relative_square(side).index()];
     }
 
-    template <size_t Size>
-    static void fused_add_add_sub_sub(simd::Vec *out, const simd::Vec *in, const simd::Vec *add1,
-                                      const simd::Vec *add2, const simd::Vec *sub1,
-                                      const simd::Vec *sub2)
+    void acc_add_piece(accumulator &acc, chess::Color side, chess::Square king_sq,
+                       chess::Piece piece, chess::Square square)
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(
-                simd::add16(simd::sub16(simd::add16(in[i], add1[i]), sub1[i]), add2[i]), sub2[i]);
+        kernels::fused_add<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
+                               feature_lookup(king_sq, side, piece, square), simd::Vec{});
     }
 };
 
@@ -3,13 +3,16 @@
 #include <memory>
 #include <utility>
 
+#include "abdada.h"
 #include "chess.h"
 #include "chess960.h"
 #include "chessmap.h"
 #include "cuckoo.h"
 #include "endgame.h"
+#include "evaluation.h"
 #include "features.h"
 #include "legal.h"
+#include "memory.h"
 #include "movegen.h"
 #include "nnue2.h"
 #include "param.h"
@@ -67,12 +70,33 @@ struct search_result
     }
 };
 
+// every search thread's node counter, so any of them can total the search, see [lazysmp]
+struct node_counters
+{
+    std::vector<const std::atomic<uint64_t> *> counters;
+
+    uint64_t sum() const
+    {
+        uint64_t total = 0;
+        for (const auto *counter : counters)
+            total += counter->load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
 struct engine_stats
 {
-    int32_t nodes_searched;
+    uint64_t nodes_searched;
     int16_t tt_occupancy;
     int32_t sel_depth;
     std::chrono::milliseconds total_time;
+    table_stats tt{};
+    // static eval cache, hits are network evaluations we did not have to run
+    uint64_t eval_probes = 0;
+    uint64_t eval_hits = 0;
+    // qsearch stand pats decided by pesto alone, see global::lazy_eval
+    uint64_t lazy_probes = 0;
+    uint64_t lazy_skips = 0;
 
     long get_nps() const
     {
@@ -99,7 +123,28 @@ struct engine_stats
         return engine_stats{.nodes_searched = nodes_searched + other.nodes_searched,
                             .tt_occupancy = std::max(tt_occupancy, other.tt_occupancy),
                             .sel_depth = std::max(sel_depth, other.sel_depth),
-                            .total_time = std::max(total_time, other.total_time)};
+                            .total_time = std::max(total_time, other.total_time),
+                            .tt = tt.append(other.tt),
+                            .eval_probes = eval_probes + other.eval_probes,
+                            .eval_hits = eval_hits + other.eval_hits,
+                            .lazy_probes = lazy_probes + other.lazy_probes,
+                            .lazy_skips = lazy_skips + other.lazy_skips};
+    }
+
+    void display_eval_cache() const
+    {
+        double rate = eval_probes == 0 ? 0.0 : 100.0 * double(eval_hits) / double(eval_probes);
+        std::cout << "info string evalcache probes " << eval_probes << " hits " << eval_hits
+                  << " (" << std::fixed << std::setprecision(1) << rate << "%) saved "
+                  << eval_hits << " evaluations" << std::defaultfloat << std::endl;
+    }
+
+    void display_lazy_eval() const
+    {
+        double rate = lazy_probes == 0 ? 0.0 : 100.0 * double(lazy_skips) / double(lazy_probes);
+        std::cout << "info string lazyeval probes " << lazy_probes << " skipped " << lazy_skips
+                  << " (" << std::fixed << std::setprecision(1) << rate << "%) nnue evaluations"
+                  << std::defaultfloat << std::endl;
     }
 };
 
@@ -453,7 +498,7 @@ struct engine
     // tt
     table *m_table;
     // move ordering
-    std::unique_ptr<heuristics> m_heuristics = std::make_unique<heuristics>();
+    memory::large_ptr<heuristics> m_heuristics{global::large_pages};
     // search stack
     constexpr static int SEARCH_STACK_PREFIX = 10;
     search_stack *m_stack = nullptr;
@@ -468,6 +513,9 @@ struct engine
     // pawn keys
     position_pawn_keys m_keys{};
 
+    // material and piece squares, for lazy evaluation
+    pesto::incremental m_pesto{};
+
     // root move list
     root_move_list m_root_moves{};
 
@@ -475,6 +523,23 @@ struct engine
 
     std::unique_ptr<chessmap::net> m_chessmap;
 
+    // raw nnue outputs by zobrist key
+    std::unique_ptr<nnue2::eval_cache> m_eval_cache;
+
+    // nodes this thread searched, the other threads read it through [m_counters]
+    alignas(64) std::atomic<uint64_t> m_nodes = 0;
+    // every thread's counter, null when searching alone
+    const node_counters *m_counters = nullptr;
+    // node limit of the search, 0 for none, and the own count at which the total is next checked
+    uint64_t m_node_limit = 0;
+    uint64_t m_next_limit_check = UINT64_MAX;
+
+    // positions the threads are inside of, shared by lazysmp, and the same table during a
+    // search with global::abdada on, null otherwise
+    busy_table *m_busy = nullptr;
+    busy_table *m_busy_active = nullptr;
+    int m_thread_index = 0;
+
     // must be set via methods
     explicit engine(table *table) : engine(nullptr, nullptr, table)
     {
@@ -491,9 +556,11 @@ struct engine
         }
 
         m_chessmap = std::make_unique<chessmap::net>();
+        m_eval_cache = std::make_unique<nnue2::eval_cache>();
 
         util::init();
         cuckoo::init();
+        pesto::init();
 
         m_stack = new search_stack[param::MAX_DEPTH + SEARCH_STACK_PREFIX];
         post_search_smp();
@@ -505,6 +572,35 @@ struct engine
         delete[] m_stack;
     }
 
+    // bytes of the per thread state the search walks over every node
+    void display_footprint() const
+    {
+        constexpr size_t KB = 1024;
+        std::cout << "info string per thread nnue stack " << m_nnue->stack_bytes() / KB
+                  << " KB finny table " << m_nnue->table_bytes() / KB << " KB chessmap stack "
+                  << m_chessmap->stack_bytes() / KB << " KB search stack "
+                  << (param::MAX_DEPTH + SEARCH_STACK_PREFIX) * sizeof(search_stack) / KB
+                  << " KB heuristics " << sizeof(heuristics) / KB << " KB\n";
+    }
+
+    // back to a freshly constructed engine, without reallocating
+    void new_game()
+    {
+        std::destroy_at(m_heuristics.get());
+        std::construct_at(m_heuristics.get());
+        m_eval_cache->clear();
+        compute_contempt();
+        post_search_smp();
+    }
+
+    // cached scores came from the old weights
+    void set_nnue(nnue2::net *nnue)
+    {
+        m_nnue = nnue;
+        m_eval_cache->clear();
+        post_search_smp();
+    }
+
     void compute_contempt()
     {
         for (int piece_count = 2; piece_count < 64; ++piece_count)
@@ -552,7 +648,10 @@ struct engine
     {
         // update stats
         auto reference_time = timer::now();
-        m_stats = engine_stats{0, 0, 0, timer::now() - reference_time};
+        m_stats = engine_stats{0, 0, 0, timer::now() - reference_time, {}, 0, 0};
+        m_nodes.store(0, std::memory_order_relaxed);
+        tt_stats = {};
+        m_eval_cache->m_probes = m_eval_cache->m_hits = 0;
 
         // init nnue
         m_nnue->initialize(m_position);
@@ -563,6 +662,8 @@ struct engine
 
         m_keys.initialize(m_position);
 
+        m_pesto.initialize(m_position);
+
         m_root_moves.load(m_position);
     }
 
@@ -576,7 +677,14 @@ struct engine
                     5 * m_position.pieces(chess::PieceType::ROOK).count() +
                     12 * m_position.pieces(chess::PieceType::QUEEN).count();
 
-        int32_t score = m_nnue->evaluate(m_position);
+        // a hit skips both the accumulator catchup and the output layer
+        int32_t score;
+        const uint64_t key = m_position.hash();
+        if (!m_eval_cache->probe(key, score))
+        {
+            score = m_nnue->evaluate(m_position);
+            m_eval_cache->store(key, score);
+        }
 
         // tempo, acts like a contempt value, decrease to draw more, increase to win more against
         // weaker opponents
@@ -608,6 +716,7 @@ struct engine
         else
         {
             m_keys.make_move(m_position, move);
+            m_pesto.make_move(m_position, move);
             ss->is_cap = m_heuristics->is_capture(m_position, move);
 
             assert(m_position.at(move.from()) < 12);
@@ -636,11 +745,60 @@ struct engine
             m_nnue->unmake_move();
             m_chessmap->unmake_move();
             m_keys.unmake_move();
+            m_pesto.unmake_move();
         }
 
         m_filter.remove(ss->key);
     }
 
+    uint64_t nodes() const
+    {
+        return m_nodes.load(std::memory_order_relaxed);
+    }
+
+    // nodes of the whole search, over all threads
+    uint64_t total_nodes() const
+    {
+        return m_counters != nullptr ? m_counters->sum() : nodes();
+    }
+
+    void count_node()
+    {
+        // only this thread writes the counter, so no locked add
+        const uint64_t count = nodes() + 1;
+        m_nodes.store(count, std::memory_order_relaxed);
+
+        if (m_timer.is_check_due(count))
+            m_timer.check(count);
+
+        if (count >= m_next_limit_check)
+            check_node_limit(count);
+    }
+
+    // stops every thread once the total reaches the limit, otherwise checks again after this
+    // thread's share of what is left, so the search ends at most about a node per thread late
+    void check_node_limit(uint64_t count)
+    {
+        const uint64_t total = total_nodes();
+        if (total >= m_node_limit)
+        {
+            m_timer.stop();
+            m_next_limit_check = UINT64_MAX;
+            return;
+        }
+
+        const uint64_t threads = m_counters != nullptr ? m_counters->counters.size() : 1;
+        m_next_limit_check = count + std::max<uint64_t>(1, (m_node_limit - total) / threads);
+    }
+
+    // [m_stats] with the nodes and nps of every thread so far
+    void display_live(const search_result &result) const
+    {
+        engine_stats live = m_stats;
+        live.nodes_searched = total_nodes();
+        live.display_uci(result);
+    }
+
     template <bool is_pv_node>
     int16_t qsearch(int16_t alpha, int16_t beta, int depth, search_stack *ss)
     {
@@ -650,9 +808,7 @@ struct engine
         ss->pv_init();
         m_stats.sel_depth = std::max(m_stats.sel_depth, ply + 1);
 
-        m_stats.nodes_searched += 1;
-        if ((m_stats.nodes_searched & 4095) == 0)
-            m_timer.check();
+        count_node();
 
         if (m_timer.is_stopped())
             return 0;
@@ -738,10 +894,28 @@ struct engine
             }
             else
             {
+                // [lazy stand pat]
+                if (global::lazy_eval && !is_pv_node && !param::IS_DECISIVE(beta))
+                {
+                    m_stats.lazy_probes++;
+                    const int lazy_score =
+                        std::min(m_pesto.evaluate(m_position.sideToMove()) - global::lazy_margin,
+                                 (int)param::NNUE_MAX);
+                    if (lazy_score >= beta)
+                    {
+                        m_stats.lazy_skips++;
+
+                        // fail soft like the stand pat below, but nothing is stored, a bound
+                        // from pesto must not cut or adjust the eval of later nnue probes
+                        return (beta + lazy_score) / 2;
+                    }
+                }
+
                 unadjusted_static_eval = evaluate(ss, tt_result.move);
                 ss->static_eval = best_score =
                     to_corrected_static_eval(unadjusted_static_eval, ss).first;
 
+                TT_STAT(qsearch_writes++);
                 bucket.store(key, param::NO_FLAG, best_score, ply, param::UNSEARCHED_DEPTH,
                              chess::Move::NO_MOVE, unadjusted_static_eval, false,
                              m_table->m_generation, entry);
@@ -859,6 +1033,7 @@ struct engine
         uint8_t flag = best_score >= beta ? param::BETA_FLAG : param::ALPHA_FLAG;
 
         // assert(!m_timer.is_stopped());
+        TT_STAT(qsearch_writes++);
         bucket.store(key, flag, best_score, ply, depth_stored, best_move, unadjusted_static_eval,
                      ss->tt_hit && ss->tt_pv, m_table->m_generation, entry);
 
@@ -892,9 +1067,7 @@ struct engine
         const int32_t ply = ss->ply;
         ss->pv_init();
 
-        m_stats.nodes_searched += 1;
-        if ((m_stats.nodes_searched & 4095) == 0)
-            m_timer.check();
+        count_node();
 
         if (m_timer.is_stopped())
             return 0;
@@ -917,7 +1090,7 @@ struct engine
         // [qsearch]
         if (depth <= 0)
         {
-            m_stats.nodes_searched -= 1;
+            m_nodes.store(nodes() - 1, std::memory_order_relaxed);
             return qsearch<is_pv_node>(alpha, beta, depth, ss);
         }
 
@@ -1310,6 +1483,10 @@ struct engine
         if (!has_excluded)
             ss->complex = 0;
 
+        // [abdada] tell the other threads we are in here
+        busy_table::holder busy{is_root ? nullptr : m_busy_active, m_position.hash(), depth, ply,
+                                m_thread_index};
+
         chess::Move move;
         while ((move = gen.next_move()) != chess::Move::NO_MOVE)
         {
@@ -1325,7 +1502,7 @@ struct engine
             move_count += 1;
             ss->move_count = move_count;
 
-            int64_t old_nodes_searched = m_stats.nodes_searched;
+            uint64_t old_nodes_searched = nodes();
 
             bool is_capture = m_heuristics->is_capture(m_position, move);
             bool is_quiet = !is_capture;
@@ -1474,6 +1651,12 @@ struct engine
                 reduction -= history_score /
                              (is_quiet ? features::QUIET_LMR_DIV : features::CAPTURE_LMR_DIV);
 
+                // [abdada] reduce if another thread is already searching this child
+                if (m_busy_active != nullptr &&
+                    m_busy_active->is_busy(m_position.hash(), new_depth - reduction,
+                                           m_thread_index))
+                    reduction += 1;
+
                 int32_t reduced_depth = std::clamp(new_depth - reduction, 1, new_depth + 1);
                 score = -negamax<false>(-(alpha + 1), -alpha, reduced_depth, ss + 1, true);
                 if (score > alpha && reduced_depth < new_depth)
@@ -1511,7 +1694,7 @@ struct engine
             if (is_root)
             {
                 root_move_list::root_move &root = m_root_moves.get_by_move(move);
-                root.nodes += m_stats.nodes_searched - old_nodes_searched;
+                root.nodes += nodes() - old_nodes_searched;
                 root.average_score =
                     !param::IS_VALID(root.average_score) ? score : (score + root.average_score) / 2;
 
@@ -1775,6 +1958,18 @@ struct engine
         std::cout.imbue(original);
     }
 
+    // helpers skip some iterations in a per thread pattern, so at any time they are spread over
+    // the next few depths instead of all repeating the main thread's
+    static bool skip_depth(int thread_index, int32_t depth)
+    {
+        // https://github.com/official-stockfish/Stockfish/blob/sf_10/src/search.cpp
+        constexpr int SKIP_SIZE[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+        constexpr int SKIP_PHASE[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+        const int i = (thread_index + 19) % 20;
+        return ((depth + SKIP_PHASE[i]) / SKIP_SIZE[i]) % 2 != 0;
+    }
+
     search_result search(const chess::Board &reference, search_param param, bool verbose = false)
     {
         // timer info first
@@ -1790,6 +1985,12 @@ struct engine
 
         begin();
 
+        m_node_limit = param.nodes;
+        m_next_limit_check = m_node_limit > 0 ? 1 : UINT64_MAX;
+
+        m_thread_index = param.thread_index;
+        m_busy_active = global::abdada ? m_busy : nullptr;
+
         search_result result{};
 
         if (m_endgame != nullptr && m_endgame->is_stored(m_position))
@@ -1814,6 +2015,10 @@ struct engine
                 result.score = 0;
             }
 
+            m_stats.nodes_searched = nodes();
+            m_stats.tt = tt_stats;
+            m_stats.eval_probes = m_eval_cache->m_probes;
+            m_stats.eval_hits = m_eval_cache->m_hits;
             return result;
         }
 
@@ -1824,6 +2029,10 @@ struct engine
 
         for (int32_t depth = 1; depth <= std::min(param::MAX_DEPTH - 4, control.depth); depth += 1)
         {
+            // [helper depth skipping]
+            if (!param.is_main_thread && depth > 1 && skip_depth(param.thread_index, depth))
+                continue;
+
             const auto &pv = m_root_moves.get_pv();
 
             // check if just one move
@@ -1916,7 +2125,7 @@ struct engine
 
                 // node factor by root nodes
                 double node_error =
-                    1.0 - double(m_root_moves.moves[0].nodes) / m_stats.nodes_searched;
+                    1.0 - double(m_root_moves.moves[0].nodes) / nodes();
                 double node_factor = node_error / 2.0;
 
                 // std::cout << move_change_extension << ", " << node_factor << "\n";
@@ -1930,20 +2139,25 @@ struct engine
                 break;
 
             // display info
+            m_stats.nodes_searched = nodes();
             m_stats.total_time = timer::now() - reference_time;
             m_stats.tt_occupancy = m_table->occupied();
             if (param.is_main_thread && verbose)
             {
-                m_stats.display_uci(result);
+                display_live(result);
             }
         }
 
         // final log
+        m_stats.nodes_searched = nodes();
+        m_stats.tt = tt_stats;
+        m_stats.eval_probes = m_eval_cache->m_probes;
+        m_stats.eval_hits = m_eval_cache->m_hits;
         m_stats.total_time = timer::now() - reference_time;
         m_stats.tt_occupancy = m_table->occupied();
         if (param.is_main_thread && verbose)
         {
-            m_stats.display_uci(result);
+            display_live(result);
         }
 
         return result;
@@ -1,7 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdint>
 
-#include "../hpplib/chess.h"
+#include "chess.h"
+#include "param.h"
 
 // from http://www.tckerrigan.com/Chess/TSCP/Community/
 namespace pesto
@@ -86,7 +90,8 @@ constexpr std::array<const int32_t *, 6> mg_pesto_table = {mg_pawn_table, mg_kni
 constexpr std::array<const int32_t *, 6> eg_pesto_table = {eg_pawn_table, eg_knight_table, eg_bishop_table,
                                                            eg_rook_table, eg_queen_table,  eg_king_table};
 
-constexpr int32_t gamephaseInc[12] = {0, 0, 1, 1, 1, 1, 2, 2, 4, 4, 0, 0};
+// by chess::Piece, white pieces first
+constexpr int32_t gamephaseInc[12] = {0, 1, 1, 2, 4, 0, 0, 1, 1, 2, 4, 0};
 inline int32_t mg_table[12][64];
 inline int32_t eg_table[12][64];
 inline std::atomic<bool> initialized = false;
@@ -144,4 +149,99 @@ inline int32_t evaluate(const chess::Board &board)
     int egPhase = 24 - mgPhase;
     return (mgScore * mgPhase + egScore * egPhase) / 24;
 }
+
+// the same score kept per ply from the moves made, cheap enough to ask before the network
+struct incremental
+{
+    // white minus black
+    struct entry
+    {
+        int32_t mg;
+        int32_t eg;
+        int32_t phase;
+    };
+
+    std::array<entry, param::MAX_DEPTH> stack{};
+    int head = 0;
+
+    void initialize(const chess::Board &board)
+    {
+        head = 0;
+        stack[0] = {};
+
+        auto occ = board.occ();
+        while (occ)
+        {
+            const chess::Square sq = occ.pop();
+            add(stack[0], board.at(sq), sq, 1);
+        }
+    }
+
+    void make_move(const chess::Board &board, chess::Move move)
+    {
+        head += 1;
+        entry &e = stack[head];
+        e = stack[head - 1];
+
+        const chess::Piece moving = board.at(move.from());
+        switch (move.typeOf())
+        {
+        case chess::Move::NORMAL:
+            if (board.at(move.to()) != chess::Piece::NONE)
+                add(e, board.at(move.to()), move.to(), -1);
+
+            add(e, moving, move.from(), -1);
+            add(e, moving, move.to(), 1);
+            break;
+
+        case chess::Move::PROMOTION:
+            if (board.at(move.to()) != chess::Piece::NONE)
+                add(e, board.at(move.to()), move.to(), -1);
+
+            add(e, moving, move.from(), -1);
+            add(e, chess::Piece{move.promotionType(), moving.color()}, move.to(), 1);
+            break;
+
+        case chess::Move::ENPASSANT:
+            add(e, moving, move.from(), -1);
+            add(e, moving, move.to(), 1);
+            add(e, board.at(move.to().ep_square()), move.to().ep_square(), -1);
+            break;
+
+        case chess::Move::CASTLING: {
+            // the move is king takes own rook
+            const bool king_side = move.to() > move.from();
+            const chess::Piece rook = board.at(move.to());
+            add(e, moving, move.from(), -1);
+            add(e, rook, move.to(), -1);
+            add(e, moving, chess::Square::castling_king_square(king_side, board.sideToMove()), 1);
+            add(e, rook, chess::Square::castling_rook_square(king_side, board.sideToMove()), 1);
+            break;
+        }
+        }
+    }
+
+    void unmake_move()
+    {
+        head -= 1;
+    }
+
+    // tapered, from the side to move
+    int32_t evaluate(chess::Color side_to_move) const
+    {
+        const entry &e = stack[head];
+        const int mg_phase = std::min(e.phase, 24);
+        const int32_t score = (e.mg * mg_phase + e.eg * (24 - mg_phase)) / 24;
+        return side_to_move == chess::Color::WHITE ? score : -score;
+    }
+
+  private:
+    static void add(entry &e, chess::Piece piece, chess::Square sq, int sign)
+    {
+        const int32_t side = piece.color() == chess::Color::WHITE ? sign : -sign;
+        e.mg += side * mg_table[piece][sq.index()];
+        e.eg += side * eg_table[piece][sq.index()];
+        e.phase += sign * gamephaseInc[piece];
+    }
+};
 } // namespace pesto
@@ -0,0 +1,939 @@
+#pragma once
+
+#include "chess.h"
+#include "simd.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cinttypes>
+#include <cstddef>
+#include <utility>
+
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+
+// accumulator pieces shared by every network, templated on the hidden layer size so each
+// network shape gets its own unrolled copy from one source
+namespace kernels
+{
+
+// the feature changes of one move
+struct update
+{
+    chess::Square king_sq[2];
+
+    std::pair<chess::Square, chess::Piece> add1;
+    std::pair<chess::Square, chess::Piece> add2;
+    std::pair<chess::Square, chess::Piece> sub1;
+    std::pair<chess::Square, chess::Piece> sub2;
+
+    enum
+    {
+        MOVE,
+        CAPTURE,
+        CASTLE
+    } type;
+};
+
+// fills [update] with what [move] changes, called before it is made on [board]
+inline void record(update &update, const chess::Board &board, const chess::Move &move)
+{
+    // new king pos
+    update.king_sq[0] = board.kingSq(chess::Color::WHITE);
+    update.king_sq[1] = board.kingSq(chess::Color::BLACK);
+    if (board.at(move.from()).type() == chess::PieceType::KING)
+    {
+        // check castle
+        if (move.typeOf() == chess::Move::CASTLING)
+        {
+            const bool king_side = move.to() > move.from();
+            const chess::Square king_to =
+                chess::Square::castling_king_square(king_side, board.sideToMove());
+            update.king_sq[board.sideToMove()] = king_to;
+        }
+        else
+        {
+            update.king_sq[board.sideToMove()] = move.to();
+        }
+    }
+
+    chess::Piece from = board.at(move.from());
+    chess::Piece to = board.at(move.to());
+    bool is_capture = to != chess::Piece::NONE;
+    update.type = update::MOVE;
+    switch (move.typeOf())
+    {
+    case chess::Move::NORMAL: {
+        update.add1 = {move.to(), from};
+        update.sub1 = {move.from(), from};
+
+        if (is_capture)
+        {
+            update.type = update::CAPTURE;
+            update.sub2 = {move.to(), to};
+        }
+        break;
+    }
+    case chess::Move::ENPASSANT: {
+        update.type = update::CAPTURE;
+
+        update.add1 = {move.to(), from};
+        update.sub1 = {move.from(), from};
+
+        update.sub2 = {move.to().ep_square(), board.at(move.to().ep_square())};
+        break;
+    }
+    case chess::Move::PROMOTION: {
+        update.add1 = {move.to(), chess::Piece{board.sideToMove(), move.promotionType()}};
+        update.sub1 = {move.from(), from};
+
+        if (is_capture)
+        {
+            update.type = update::CAPTURE;
+            update.sub2 = {move.to(), to};
+        }
+        break;
+    }
+    case chess::Move::CASTLING: {
+        const bool king_side = move.to() > move.from();
+        const chess::Square rook_to =
+            chess::Square::castling_rook_square(king_side, board.sideToMove());
+        const chess::Square king_to =
+            chess::Square::castling_king_square(king_side, board.sideToMove());
+
+        update.type = update::CASTLE;
+        update.add1 = {king_to, from};
+        update.sub1 = {move.from(), from};
+
+        update.add2 = {rook_to, to};
+        update.sub2 = {move.to(), to};
+        break;
+    }
+    default:
+        assert(false);
+    }
+}
+
+/// feature rows ///
+
+// int8 rows are widened and multiplied by [scale], int16 rows are used as they are
+inline __attribute__((always_inline)) simd::Vec load_row(const int8_t *row, size_t i,
+                                                         simd::Vec scale)
+{
+    return simd::widen8(row + i * simd::WIDTH, scale);
+}
+
+inline __attribute__((always_inline)) simd::Vec load_row(const int16_t *row, size_t i,
+                                                         simd::Vec)
+{
+    return reinterpret_cast<const simd::Vec *>(row)[i];
+}
+
+/// fused updates ///
+
+// [out] may be [in], the refresh paths update in place
+
+template <size_t Size>
+inline void fused_copy(simd::Vec *__restrict__ out, const simd::Vec *__restrict__ in)
+{
+    for (size_t i = 0; i < Size / simd::WIDTH; ++i)
+        out[i] = in[i];
+}
+
+template <size_t Size, typename Row>
+inline void fused_add(simd::Vec *out, const simd::Vec *in, const Row *__restrict__ add,
+                      simd::Vec scale)
+{
+    for (size_t i = 0; i < Size / simd::WIDTH; ++i)
+        out[i] = simd::add16(in[i], load_row(add, i, scale));
+}
+
+template <size_t Size, typename Row>
+inline void fused_sub(simd::Vec *out, const simd::Vec *in, const Row *__restrict__ sub,
+                      simd::Vec scale)
+{
+    for (size_t i = 0; i < Size / simd::WIDTH; ++i)
+        out[i] = simd::sub16(in[i], load_row(sub, i, scale));
+}
+
+template <size_t Size, typename Row>
+inline void fused_add_sub(simd::Vec *out, const simd::Vec *in,
+                          const Row *__restrict__ add, const Row *__restrict__ sub,
+                          simd::Vec scale)
+{
+    for (size_t i = 0; i < Size / simd::WIDTH; ++i)
+        out[i] = simd::sub16(simd::add16(in[i], load_row(add, i, scale)), load_row(sub, i, scale));
+}
+
+/// incremental catchup ///
+
+// the most plies catchup replays before it prefers a refresh
+constexpr int MAX_CATCHUP = 8;
+
+// accumulators kept per thread, ply p lives in slot p % RING, only the top plies are ever read
+// back so deeper lines reuse slots instead of walking a MAX_DEPTH stack out of cache
+constexpr int RING = 16;
+static_assert((RING & (RING - 1)) == 0 && RING > MAX_CATCHUP + 1);
+
+inline int ring_slot(int ply)
+{
+    return ply & (RING - 1);
+}
+
+// the ply whose accumulator each ring slot holds, per side, so a slot written by another line
+// is never read back as the ply it held before, whichever plies were skipped in between
+struct ring_owners
+{
+    int ply[RING][2];
+
+    ring_owners()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto &slot : ply)
+            slot[0] = slot[1] = -1;
+    }
+
+    // whether the slot of [p] holds its up to date accumulator
+    bool holds(int p, int side) const
+    {
+        return p >= 0 && ply[ring_slot(p)][side] == p;
+    }
+
+    void claim(int p, int side)
+    {
+        ply[ring_slot(p)][side] = p;
+    }
+
+    void release(int p, int side)
+    {
+        if (holds(p, side))
+            ply[ring_slot(p)][side] = -1;
+    }
+};
+
+// pending rows of plies (base, head] for one perspective
+template <typename Row> struct catchup_job
+{
+    const simd::Vec *in;
+    int plies;
+    // rows of ply p are [add_end[p - 1], add_end[p])
+    int add_end[MAX_CATCHUP + 1];
+    int sub_end[MAX_CATCHUP + 1];
+    const Row *adds[2 * (MAX_CATCHUP + 1)];
+    const Row *subs[2 * (MAX_CATCHUP + 1)];
+    // nullptr for plies that stay dirty
+    simd::Vec *outs[MAX_CATCHUP + 1];
+};
+
+// appends the rows of [up] as ply [p] of [job], [lookup] maps (king_sq, side, piece, sq)
+// to a feature row
+template <typename Row, typename Lookup>
+inline void push_rows(catchup_job<Row> &job, int p, const update &up, chess::Color side,
+                      Lookup &&lookup)
+{
+    int adds = p == 0 ? 0 : job.add_end[p - 1];
+    int subs = p == 0 ? 0 : job.sub_end[p - 1];
+    const chess::Square king_sq = up.king_sq[side];
+
+    job.adds[adds++] = lookup(king_sq, side, up.add1.second, up.add1.first);
+    job.subs[subs++] = lookup(king_sq, side, up.sub1.second, up.sub1.first);
+    if (up.type != update::MOVE)
+        job.subs[subs++] = lookup(king_sq, side, up.sub2.second, up.sub2.first);
+    if (up.type == update::CASTLE)
+        job.adds[adds++] = lookup(king_sq, side, up.add2.second, up.add2.first);
+
+    job.add_end[p] = adds;
+    job.sub_end[p] = subs;
+}
+
+// applies every pending row in one pass, keeping a tile of the accumulator in registers
+// instead of streaming it through memory once per ply
+template <size_t Size, typename Row>
+inline void fused_catchup(const catchup_job<Row> *jobs, int num_jobs, simd::Vec scale)
+{
+    constexpr size_t BLOCKS = Size / simd::WIDTH;
+    constexpr size_t TILE = std::min(simd::TILE, BLOCKS);
+    static_assert(BLOCKS % TILE == 0);
+
+    for (size_t t = 0; t < BLOCKS; t += TILE)
+    {
+        for (int j = 0; j < num_jobs; ++j)
+        {
+            const catchup_job<Row> &job = jobs[j];
+
+            simd::Vec regs[TILE];
+            for (size_t k = 0; k < TILE; ++k)
+                regs[k] = job.in[t + k];
+
+            int a = 0;
+            int s = 0;
+            for (int p = 0; p < job.plies; ++p)
+            {
+                for (; a < job.add_end[p]; ++a)
+                    for (size_t k = 0; k < TILE; ++k)
+                        regs[k] = simd::add16(regs[k], load_row(job.adds[a], t + k, scale));
+
+                for (; s < job.sub_end[p]; ++s)
+                    for (size_t k = 0; k < TILE; ++k)
+                        regs[k] = simd::sub16(regs[k], load_row(job.subs[s], t + k, scale));
+
+                if (job.outs[p] != nullptr)
+                    for (size_t k = 0; k < TILE; ++k)
+                        job.outs[p][t + k] = regs[k];
+            }
+        }
+    }
+}
+
+/// output ///
+
+// sum of weight * clamp(acc, 0, QA)^2 over [Size] values
+#if defined(__AVX512BW__)
+template <int QA, size_t Size>
+inline int32_t flatten(const int16_t *__restrict__ acc_ptr, const int16_t *__restrict__ weight_ptr)
+{
+    static_assert(Size % 64 == 0);
+    const auto *acc = reinterpret_cast<const __m512i *>(acc_ptr);
+    const auto *weight = reinterpret_cast<const __m512i *>(weight_ptr);
+
+    const __m512i vec_zero = _mm512_setzero_si512();
+    const __m512i vec_qa = _mm512_set1_epi16(QA);
+
+    // two accumulators to break the dependency chain
+    __m512i sum0 = vec_zero;
+    __m512i sum1 = vec_zero;
+
+    // Size / 32 __m512i blocks, 2 per iteration
+    for (size_t i = 0; i < Size / 32; i += 2)
+    {
+        const __m512i c0 = _mm512_min_epi16(_mm512_max_epi16(acc[i + 0], vec_zero), vec_qa);
+        const __m512i c1 = _mm512_min_epi16(_mm512_max_epi16(acc[i + 1], vec_zero), vec_qa);
+
+        // (weight * clamped) * clamped, same wrapping 16 bit product as the avx2 path
+        const __m512i pm0 = _mm512_mullo_epi16(weight[i + 0], c0);
+        const __m512i pm1 = _mm512_mullo_epi16(weight[i + 1], c1);
+
+#if defined(__AVX512VNNI__)
+        // vpdpwssd fuses the madd and the add, without saturation
+        sum0 = _mm512_dpwssd_epi32(sum0, pm0, c0);
+        sum1 = _mm512_dpwssd_epi32(sum1, pm1, c1);
+#else
+        sum0 = _mm512_add_epi32(sum0, _mm512_madd_epi16(pm0, c0));
+        sum1 = _mm512_add_epi32(sum1, _mm512_madd_epi16(pm1, c1));
+#endif
+    }
+
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(sum0, sum1));
+}
+#elif defined(__AVX2__)
+template <int QA, size_t Size>
+inline int32_t flatten(const int16_t *__restrict__ acc_ptr, const int16_t *__restrict__ weight_ptr)
+{
+    static_assert(Size % 32 == 0);
+    const auto *acc = reinterpret_cast<const __m256i *>(acc_ptr);
+    const auto *weight = reinterpret_cast<const __m256i *>(weight_ptr);
+
+    const __m256i vec_zero = _mm256_setzero_si256();
+    const __m256i vec_qa = _mm256_set1_epi16(QA);
+
+    __m256i sum = vec_zero;
+
+    // Size / 16 gives us the total number of __m256i blocks.
+    // We process 2 blocks (32 elements) per iteration.
+    for (size_t i = 0; i < Size / 16; i += 2)
+    {
+        // Prefetching next blocks
+        _mm_prefetch((const char *)&acc[i + 2], _MM_HINT_T0);
+        _mm_prefetch((const char *)&weight[i + 2], _MM_HINT_T0);
+
+        // Load 256-bit vectors via pointer dereference
+        const __m256i us = acc[i + 0];
+        const __m256i them = acc[i + 1];
+        const __m256i us_weights = weight[i + 0];
+        const __m256i them_weights = weight[i + 1];
+
+        // Clamp: min(max(x, 0), QA)
+        const __m256i us_clamped = _mm256_min_epi16(_mm256_max_epi16(us, vec_zero), vec_qa);
+        const __m256i them_clamped = _mm256_min_epi16(_mm256_max_epi16(them, vec_zero), vec_qa);
+
+        // Compute: (weight * clamped) then horizontal-multiply-add with clamped
+        // This effectively computes sum(weight * clamped^2) widened to 32-bit
+        const __m256i us_results =
+            _mm256_madd_epi16(_mm256_mullo_epi16(us_weights, us_clamped), us_clamped);
+        const __m256i them_results =
+            _mm256_madd_epi16(_mm256_mullo_epi16(them_weights, them_clamped), them_clamped);
+
+        sum = _mm256_add_epi32(sum, us_results);
+        sum = _mm256_add_epi32(sum, them_results);
+    }
+
+    // Final horizontal reduction: 256-bit -> 128-bit -> scalar int32
+    __m128i v_low = _mm256_castsi256_si128(sum);
+    __m128i v_high = _mm256_extracti128_si256(sum, 1);
+    __m128i res = _mm_add_epi32(v_low, v_high);
+
+    // Collapse 4x32-bit into 1x32-bit
+    res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(0, 1, 2, 3)));
+    res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 0, 1)));
+
+    return _mm_cvtsi128_si32(res);
+}
+#elif defined(__SSE4_1__)
+template <int QA, size_t Size>
+inline int32_t flatten(const int16_t *__restrict__ acc_ptr, const int16_t *__restrict__ weight_ptr)
+{
+    static_assert(Size % 16 == 0);
+    const auto *acc = reinterpret_cast<const __m128i *>(acc_ptr);
+    const auto *weight = reinterpret_cast<const __m128i *>(weight_ptr);
+
+    const __m128i vec_zero = _mm_setzero_si128();
+    const __m128i vec_qa = _mm_set1_epi16(QA);
+
+    __m128i sum0 = vec_zero;
+    __m128i sum1 = vec_zero;
+
+    // Size / 8 __m128i blocks, 2 per iteration
+    for (size_t i = 0; i < Size / 8; i += 2)
+    {
+        const __m128i c0 = _mm_min_epi16(_mm_max_epi16(acc[i + 0], vec_zero), vec_qa);
+        const __m128i c1 = _mm_min_epi16(_mm_max_epi16(acc[i + 1], vec_zero), vec_qa);
+
+        sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_mullo_epi16(weight[i + 0], c0), c0));
+        sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_mullo_epi16(weight[i + 1], c1), c1));
+    }
+
+    __m128i res = _mm_add_epi32(sum0, sum1);
+    res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+    res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(res);
+}
+#else
+template <int QA, size_t Size>
+inline int32_t flatten(const int16_t *__restrict__ acc_ptr, const int16_t *__restrict__ weight_ptr)
+{
+    static_assert(Size % 16 == 0);
+    const auto *acc = reinterpret_cast<const int16x8_t *>(acc_ptr);
+    const auto *weight = reinterpret_cast<const int16x8_t *>(weight_ptr);
+
+    const int16x8_t v_zero = vdupq_n_s16(0);
+    const int16x8_t v_qa = vdupq_n_s16(QA);
+
+    int32x4_t out0 = vdupq_n_s32(0);
+    int32x4_t out1 = vdupq_n_s32(0);
+    int32x4_t out2 = vdupq_n_s32(0);
+    int32x4_t out3 = vdupq_n_s32(0);
+
+    for (size_t i = 0; i < Size / 8; i += 2)
+    {
+        __builtin_prefetch(&acc[i + 2]);
+        __builtin_prefetch(&weight[i + 2]);
+
+        int16x8_t c0 = vminq_s16(vmaxq_s16(acc[i + 0], v_zero), v_qa);
+        int16x8_t c1 = vminq_s16(vmaxq_s16(acc[i + 1], v_zero), v_qa);
+
+        int16x8_t pm0 = vmulq_s16(c0, weight[i + 0]);
+        int16x8_t pm1 = vmulq_s16(c1, weight[i + 1]);
+
+        out0 = vmlal_s16(out0, vget_low_s16(pm0), vget_low_s16(c0));
+        out1 = vmlal_s16(out1, vget_low_s16(pm1), vget_low_s16(c1));
+        out2 = vmlal_high_s16(out2, pm0, c0);
+        out3 = vmlal_high_s16(out3, pm1, c1);
+    }
+
+    return vaddvq_s32(vaddq_s32(vaddq_s32(out0, out1), vaddq_s32(out2, out3)));
+}
+#endif
+
+// the same sum for [N] accumulators against one weight vector, each weight block is loaded
+// once for all of them, which is what makes batched evaluation cheaper per position
+#if defined(__AVX512BW__)
+template <int QA, size_t Size, size_t N>
+inline void flatten_many(const int16_t *const *acc_ptrs, const int16_t *__restrict__ weight_ptr,
+                         int32_t *out)
+{
+    const auto *weight = reinterpret_cast<const __m512i *>(weight_ptr);
+    const __m512i vec_zero = _mm512_setzero_si512();
+    const __m512i vec_qa = _mm512_set1_epi16(QA);
+
+    __m512i sum[N];
+    for (size_t n = 0; n < N; ++n)
+        sum[n] = vec_zero;
+
+    for (size_t i = 0; i < Size / 32; ++i)
+    {
+        const __m512i w = weight[i];
+        for (size_t n = 0; n < N; ++n)
+        {
+            const __m512i a = reinterpret_cast<const __m512i *>(acc_ptrs[n])[i];
+            const __m512i c = _mm512_min_epi16(_mm512_max_epi16(a, vec_zero), vec_qa);
+#if defined(__AVX512VNNI__)
+            sum[n] = _mm512_dpwssd_epi32(sum[n], _mm512_mullo_epi16(w, c), c);
+#else
+            sum[n] = _mm512_add_epi32(sum[n], _mm512_madd_epi16(_mm512_mullo_epi16(w, c), c));
+#endif
+        }
+    }
+
+    for (size_t n = 0; n < N; ++n)
+        out[n] = _mm512_reduce_add_epi32(sum[n]);
+}
+#elif defined(__AVX2__)
+template <int QA, size_t Size, size_t N>
+inline void flatten_many(const int16_t *const *acc_ptrs, const int16_t *__restrict__ weight_ptr,
+                         int32_t *out)
+{
+    const auto *weight = reinterpret_cast<const __m256i *>(weight_ptr);
+    const __m256i vec_zero = _mm256_setzero_si256();
+    const __m256i vec_qa = _mm256_set1_epi16(QA);
+
+    __m256i sum[N];
+    for (size_t n = 0; n < N; ++n)
+        sum[n] = vec_zero;
+
+    for (size_t i = 0; i < Size / 16; ++i)
+    {
+        const __m256i w = weight[i];
+        for (size_t n = 0; n < N; ++n)
+        {
+            const __m256i a = reinterpret_cast<const __m256i *>(acc_ptrs[n])[i];
+            const __m256i c = _mm256_min_epi16(_mm256_max_epi16(a, vec_zero), vec_qa);
+            sum[n] = _mm256_add_epi32(sum[n], _mm256_madd_epi16(_mm256_mullo_epi16(w, c), c));
+        }
+    }
+
+    for (size_t n = 0; n < N; ++n)
+    {
+        __m128i res = _mm_add_epi32(_mm256_castsi256_si128(sum[n]),
+                                    _mm256_extracti128_si256(sum[n], 1));
+        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[n] = _mm_cvtsi128_si32(res);
+    }
+}
+#elif defined(__SSE4_1__)
+template <int QA, size_t Size, size_t N>
+inline void flatten_many(const int16_t *const *acc_ptrs, const int16_t *__restrict__ weight_ptr,
+                         int32_t *out)
+{
+    const auto *weight = reinterpret_cast<const __m128i *>(weight_ptr);
+    const __m128i vec_zero = _mm_setzero_si128();
+    const __m128i vec_qa = _mm_set1_epi16(QA);
+
+    __m128i sum[N];
+    for (size_t n = 0; n < N; ++n)
+        sum[n] = vec_zero;
+
+    for (size_t i = 0; i < Size / 8; ++i)
+    {
+        const __m128i w = weight[i];
+        for (size_t n = 0; n < N; ++n)
+        {
+            const __m128i a = reinterpret_cast<const __m128i *>(acc_ptrs[n])[i];
+            const __m128i c = _mm_min_epi16(_mm_max_epi16(a, vec_zero), vec_qa);
+            sum[n] = _mm_add_epi32(sum[n], _mm_madd_epi16(_mm_mullo_epi16(w, c), c));
+        }
+    }
+
+    for (size_t n = 0; n < N; ++n)
+    {
+        __m128i res = sum[n];
+        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[n] = _mm_cvtsi128_si32(res);
+    }
+}
+#else
+template <int QA, size_t Size, size_t N>
+inline void flatten_many(const int16_t *const *acc_ptrs, const int16_t *__restrict__ weight_ptr,
+                         int32_t *out)
+{
+    const auto *weight = reinterpret_cast<const int16x8_t *>(weight_ptr);
+    const int16x8_t v_zero = vdupq_n_s16(0);
+    const int16x8_t v_qa = vdupq_n_s16(QA);
+
+    int32x4_t lo[N];
+    int32x4_t hi[N];
+    for (size_t n = 0; n < N; ++n)
+        lo[n] = hi[n] = vdupq_n_s32(0);
+
+    for (size_t i = 0; i < Size / 8; ++i)
+    {
+        const int16x8_t w = weight[i];
+        for (size_t n = 0; n < N; ++n)
+        {
+            const int16x8_t a = reinterpret_cast<const int16x8_t *>(acc_ptrs[n])[i];
+            const int16x8_t c = vminq_s16(vmaxq_s16(a, v_zero), v_qa);
+            const int16x8_t pm = vmulq_s16(c, w);
+            lo[n] = vmlal_s16(lo[n], vget_low_s16(pm), vget_low_s16(c));
+            hi[n] = vmlal_high_s16(hi[n], pm, c);
+        }
+    }
+
+    for (size_t n = 0; n < N; ++n)
+        out[n] = vaddvq_s32(vaddq_s32(lo[n], hi[n]));
+}
+#endif
+
+/// policy ///
+
+// [Outputs] SCReLU sums of the activations [us | them] against the rows of [weights], laid out
+// [Outputs][2 * Size], the clipped activations stay in registers and rows are reduced four at a
+// time
+#if defined(__AVX2__)
+// the horizontal sums of [a], [b], [c] and [d], in that order
+inline __m128i hsum4(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    const __m256i abcd = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+    return _mm_add_epi32(_mm256_castsi256_si128(abcd), _mm256_extracti128_si256(abcd, 1));
+}
+#endif
+
+#if defined(__AVX512BW__)
+template <int QA, size_t Size, size_t Outputs>
+inline void screlu_gemv(const int16_t *us, const int16_t *them,
+                        const int16_t *__restrict__ weights, int32_t *__restrict__ out)
+{
+    static_assert(Size % 32 == 0 && Outputs % 4 == 0);
+    constexpr size_t HALF = Size / 32;
+
+    const __m512i vec_zero = _mm512_setzero_si512();
+    const __m512i vec_qa = _mm512_set1_epi16(QA);
+
+    __m512i c[2 * HALF];
+    for (size_t i = 0; i < HALF; ++i)
+    {
+        c[i] = _mm512_min_epi16(
+            _mm512_max_epi16(reinterpret_cast<const __m512i *>(us)[i], vec_zero), vec_qa);
+        c[HALF + i] = _mm512_min_epi16(
+            _mm512_max_epi16(reinterpret_cast<const __m512i *>(them)[i], vec_zero), vec_qa);
+    }
+
+    for (size_t o = 0; o < Outputs; o += 4)
+    {
+        __m256i half[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const auto *row = reinterpret_cast<const __m512i *>(weights + (o + k) * 2 * Size);
+            __m512i sum = vec_zero;
+            for (size_t i = 0; i < 2 * HALF; ++i)
+            {
+#if defined(__AVX512VNNI__)
+                sum = _mm512_dpwssd_epi32(sum, _mm512_mullo_epi16(row[i], c[i]), c[i]);
+#else
+                sum = _mm512_add_epi32(sum,
+                                       _mm512_madd_epi16(_mm512_mullo_epi16(row[i], c[i]), c[i]));
+#endif
+            }
+            half[k] = _mm256_add_epi32(_mm512_castsi512_si256(sum),
+                                       _mm512_extracti64x4_epi64(sum, 1));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o),
+                         hsum4(half[0], half[1], half[2], half[3]));
+    }
+}
+#elif defined(__AVX2__)
+template <int QA, size_t Size, size_t Outputs>
+inline void screlu_gemv(const int16_t *us, const int16_t *them,
+                        const int16_t *__restrict__ weights, int32_t *__restrict__ out)
+{
+    static_assert(Size % 16 == 0 && Outputs % 4 == 0);
+    constexpr size_t HALF = Size / 16;
+
+    const __m256i vec_zero = _mm256_setzero_si256();
+    const __m256i vec_qa = _mm256_set1_epi16(QA);
+
+    __m256i c[2 * HALF];
+    for (size_t i = 0; i < HALF; ++i)
+    {
+        c[i] = _mm256_min_epi16(
+            _mm256_max_epi16(reinterpret_cast<const __m256i *>(us)[i], vec_zero), vec_qa);
+        c[HALF + i] = _mm256_min_epi16(
+            _mm256_max_epi16(reinterpret_cast<const __m256i *>(them)[i], vec_zero), vec_qa);
+    }
+
+    for (size_t o = 0; o < Outputs; o += 4)
+    {
+        __m256i sum[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const auto *row = reinterpret_cast<const __m256i *>(weights + (o + k) * 2 * Size);
+            sum[k] = vec_zero;
+            for (size_t i = 0; i < 2 * HALF; ++i)
+                sum[k] = _mm256_add_epi32(
+                    sum[k], _mm256_madd_epi16(_mm256_mullo_epi16(row[i], c[i]), c[i]));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o),
+                         hsum4(sum[0], sum[1], sum[2], sum[3]));
+    }
+}
+#elif defined(__SSE4_1__)
+template <int QA, size_t Size, size_t Outputs>
+inline void screlu_gemv(const int16_t *us, const int16_t *them,
+                        const int16_t *__restrict__ weights, int32_t *__restrict__ out)
+{
+    static_assert(Size % 8 == 0 && Outputs % 4 == 0);
+    constexpr size_t HALF = Size / 8;
+
+    const __m128i vec_zero = _mm_setzero_si128();
+    const __m128i vec_qa = _mm_set1_epi16(QA);
+
+    __m128i c[2 * HALF];
+    for (size_t i = 0; i < HALF; ++i)
+    {
+        c[i] = _mm_min_epi16(_mm_max_epi16(reinterpret_cast<const __m128i *>(us)[i], vec_zero),
+                             vec_qa);
+        c[HALF + i] = _mm_min_epi16(
+            _mm_max_epi16(reinterpret_cast<const __m128i *>(them)[i], vec_zero), vec_qa);
+    }
+
+    for (size_t o = 0; o < Outputs; o += 4)
+    {
+        __m128i sum[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const auto *row = reinterpret_cast<const __m128i *>(weights + (o + k) * 2 * Size);
+            sum[k] = vec_zero;
+            for (size_t i = 0; i < 2 * HALF; ++i)
+                sum[k] = _mm_add_epi32(sum[k], _mm_madd_epi16(_mm_mullo_epi16(row[i], c[i]), c[i]));
+        }
+
+        const __m128i ab = _mm_hadd_epi32(sum[0], sum[1]);
+        const __m128i cd = _mm_hadd_epi32(sum[2], sum[3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o), _mm_hadd_epi32(ab, cd));
+    }
+}
+#else
+template <int QA, size_t Size, size_t Outputs>
+inline void screlu_gemv(const int16_t *us, const int16_t *them,
+                        const int16_t *__restrict__ weights, int32_t *__restrict__ out)
+{
+    static_assert(Size % 8 == 0 && Outputs % 4 == 0);
+    constexpr size_t HALF = Size / 8;
+
+    const int16x8_t v_zero = vdupq_n_s16(0);
+    const int16x8_t v_qa = vdupq_n_s16(QA);
+
+    int16x8_t c[2 * HALF];
+    for (size_t i = 0; i < HALF; ++i)
+    {
+        c[i] = vminq_s16(vmaxq_s16(vld1q_s16(us + 8 * i), v_zero), v_qa);
+        c[HALF + i] = vminq_s16(vmaxq_s16(vld1q_s16(them + 8 * i), v_zero), v_qa);
+    }
+
+    for (size_t o = 0; o < Outputs; o += 4)
+    {
+        int32x4_t sum[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const int16_t *row = weights + (o + k) * 2 * Size;
+            int32x4_t lo = vdupq_n_s32(0);
+            int32x4_t hi = vdupq_n_s32(0);
+            for (size_t i = 0; i < 2 * HALF; ++i)
+            {
+                const int16x8_t pm = vmulq_s16(c[i], vld1q_s16(row + 8 * i));
+                lo = vmlal_s16(lo, vget_low_s16(pm), vget_low_s16(c[i]));
+                hi = vmlal_high_s16(hi, pm, c[i]);
+            }
+            sum[k] = vaddq_s32(lo, hi);
+        }
+
+        vst1q_s32(out + o, vpaddq_s32(vpaddq_s32(sum[0], sum[1]), vpaddq_s32(sum[2], sum[3])));
+    }
+}
+#endif
+
+/// sparse affine ///
+
+// the positions of the set bits of every byte, turns a mask of non-zero blocks into indices
+struct nnz_lookup
+{
+    alignas(16) uint16_t idx[256][8];
+};
+
+inline constexpr nnz_lookup NNZ_TABLE = [] {
+    nnz_lookup table{};
+    for (int mask = 0; mask < 256; ++mask)
+    {
+        int j = 0;
+        for (int bit = 0; bit < 8; ++bit)
+            if (mask >> bit & 1)
+                table.idx[mask][j++] = bit;
+    }
+    return table;
+}();
+
+// plain versions of [find_nnz] and [sparse_affine], what arm builds run and the reference the
+// verify mode checks the simd ones against
+template <size_t Blocks>
+inline int find_nnz_scalar(const int32_t *__restrict__ in, uint16_t *__restrict__ out)
+{
+    int count = 0;
+    for (size_t i = 0; i < Blocks; ++i)
+        if (in[i] != 0)
+            out[count++] = static_cast<uint16_t>(i);
+    return count;
+}
+
+template <size_t Outputs>
+inline void sparse_affine_scalar(const int32_t *__restrict__ in, const uint16_t *__restrict__ nnz,
+                                 int count, const int8_t *__restrict__ weights,
+                                 const int32_t *__restrict__ bias, int32_t *__restrict__ out)
+{
+    for (size_t o = 0; o < Outputs; ++o)
+        out[o] = bias[o];
+
+    for (int j = 0; j < count; ++j)
+    {
+        const int b = nnz[j];
+        const auto *x = reinterpret_cast<const uint8_t *>(in + b);
+        const int8_t *w = weights + b * Outputs * 4;
+        for (size_t o = 0; o < Outputs; ++o)
+            for (size_t i = 0; i < 4; ++i)
+                out[o] += x[i] * w[4 * o + i];
+    }
+}
+
+// writes the indices of the non-zero blocks of [in] to [out] and returns how many there are
+// a block is four uint8 activations read as one int32, so non-zero means positive
+template <size_t Blocks>
+inline int find_nnz(const int32_t *__restrict__ in, uint16_t *__restrict__ out)
+{
+    static_assert(Blocks % 16 == 0);
+    int count = 0;
+
+#if defined(__AVX512BW__)
+    const __m512i zero = _mm512_setzero_si512();
+    for (size_t i = 0; i < Blocks; i += 16)
+    {
+        const uint16_t mask = _mm512_cmpgt_epi32_mask(_mm512_load_si512(in + i), zero);
+        for (size_t half = 0; half < 2; ++half)
+        {
+            const uint8_t m = mask >> (8 * half);
+            const __m128i base = _mm_set1_epi16(static_cast<int16_t>(i + 8 * half));
+            const __m128i idx = _mm_load_si128((const __m128i *)NNZ_TABLE.idx[m]);
+            _mm_storeu_si128((__m128i *)(out + count), _mm_add_epi16(base, idx));
+            count += std::popcount(m);
+        }
+    }
+#elif defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t i = 0; i < Blocks; i += 8)
+    {
+        const __m256i nz = _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)(in + i)), zero);
+        const uint8_t m = _mm256_movemask_ps(_mm256_castsi256_ps(nz));
+        const __m128i base = _mm_set1_epi16(static_cast<int16_t>(i));
+        _mm_storeu_si128((__m128i *)(out + count),
+                         _mm_add_epi16(base, _mm_load_si128((const __m128i *)NNZ_TABLE.idx[m])));
+        count += std::popcount(m);
+    }
+#elif defined(__SSE4_1__)
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < Blocks; i += 8)
+    {
+        const __m128i nz0 = _mm_cmpgt_epi32(_mm_load_si128((const __m128i *)(in + i)), zero);
+        const __m128i nz1 = _mm_cmpgt_epi32(_mm_load_si128((const __m128i *)(in + i + 4)), zero);
+        const uint8_t m = _mm_movemask_ps(_mm_castsi128_ps(nz0)) |
+                          _mm_movemask_ps(_mm_castsi128_ps(nz1)) << 4;
+        const __m128i base = _mm_set1_epi16(static_cast<int16_t>(i));
+        _mm_storeu_si128((__m128i *)(out + count),
+                         _mm_add_epi16(base, _mm_load_si128((const __m128i *)NNZ_TABLE.idx[m])));
+        count += std::popcount(m);
+    }
+#else
+    count = find_nnz_scalar<Blocks>(in, out);
+#endif
+
+    return count;
+}
+
+// out[o] = bias[o] + sum of in[b] . weights[b][o] over the [count] blocks listed in [nnz]
+// [in] holds uint8 activations of at most 127 in blocks of four, [weights] is int8 laid out
+// [block][Outputs][4] so every block reads one contiguous row
+template <size_t Outputs>
+inline void sparse_affine(const int32_t *__restrict__ in, const uint16_t *__restrict__ nnz,
+                          int count, const int8_t *__restrict__ weights,
+                          const int32_t *__restrict__ bias, int32_t *__restrict__ out)
+{
+    static_assert(Outputs % 16 == 0);
+
+#if defined(__AVX512BW__)
+    constexpr size_t REGS = Outputs / 16;
+    __m512i acc[REGS];
+    for (size_t k = 0; k < REGS; ++k)
+        acc[k] = _mm512_loadu_si512(bias + 16 * k);
+
+#if !defined(__AVX512VNNI__)
+    const __m512i ones = _mm512_set1_epi16(1);
+#endif
+    for (int j = 0; j < count; ++j)
+    {
+        const int b = nnz[j];
+        const __m512i x = _mm512_set1_epi32(in[b]);
+        const auto *w = (const __m512i *)(weights + b * Outputs * 4);
+        for (size_t k = 0; k < REGS; ++k)
+        {
+#if defined(__AVX512VNNI__)
+            acc[k] = _mm512_dpbusd_epi32(acc[k], x, w[k]);
+#else
+            // inputs are at most 127, so the int16 pair sums cannot saturate
+            acc[k] = _mm512_add_epi32(acc[k],
+                                      _mm512_madd_epi16(_mm512_maddubs_epi16(x, w[k]), ones));
+#endif
+        }
+    }
+
+    for (size_t k = 0; k < REGS; ++k)
+        _mm512_storeu_si512(out + 16 * k, acc[k]);
+#elif defined(__AVX2__)
+    constexpr size_t REGS = Outputs / 8;
+    __m256i acc[REGS];
+    for (size_t k = 0; k < REGS; ++k)
+        acc[k] = _mm256_loadu_si256((const __m256i *)(bias + 8 * k));
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (int j = 0; j < count; ++j)
+    {
+        const int b = nnz[j];
+        const __m256i x = _mm256_set1_epi32(in[b]);
+        const auto *w = (const __m256i *)(weights + b * Outputs * 4);
+        for (size_t k = 0; k < REGS; ++k)
+            acc[k] = _mm256_add_epi32(acc[k],
+                                      _mm256_madd_epi16(_mm256_maddubs_epi16(x, w[k]), ones));
+    }
+
+    for (size_t k = 0; k < REGS; ++k)
+        _mm256_storeu_si256((__m256i *)(out + 8 * k), acc[k]);
+#elif defined(__SSE4_1__)
+    constexpr size_t REGS = Outputs / 4;
+    __m128i acc[REGS];
+    for (size_t k = 0; k < REGS; ++k)
+        acc[k] = _mm_loadu_si128((const __m128i *)(bias + 4 * k));
+
+    const __m128i ones = _mm_set1_epi16(1);
+    for (int j = 0; j < count; ++j)
+    {
+        const int b = nnz[j];
+        const __m128i x = _mm_set1_epi32(in[b]);
+        const auto *w = (const __m128i *)(weights + b * Outputs * 4);
+        for (size_t k = 0; k < REGS; ++k)
+            acc[k] = _mm_add_epi32(acc[k], _mm_madd_epi16(_mm_maddubs_epi16(x, w[k]), ones));
+    }
+
+    for (size_t k = 0; k < REGS; ++k)
+        _mm_storeu_si128((__m128i *)(out + 4 * k), acc[k]);
+#else
+    sparse_affine_scalar<Outputs>(in, nnz, count, weights, bias, out);
+#endif
+}
+
+} // namespace kernels
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "engine.h"
+#include <chrono>
+#include <functional>
 #include <map>
 #include <thread>
 
@@ -8,35 +10,68 @@ struct lazysmp
 {
     struct search_thread
     {
-        // underlying
-        engine *eng;
-        nnue2::net *nnue;
-        endgame_table *end;
+        // underlying, allocated by the search thread itself in [init]
+        engine *eng = nullptr;
+        memory::large_ptr<nnue2::net> nnue;
+        endgame_table *end = nullptr;
         int index;
+        // -1 when threads are left to the os
+        int node;
 
-        // multithreading
+        // startup handshake, see [spawn]
         std::condition_variable cv{};
         std::mutex mutex{};
-        std::atomic<bool> is_searching = false;
+        std::atomic<bool> is_ready = false;
         std::atomic<bool> should_quit = false;
 
+        // last pool epoch this thread has answered
+        uint64_t seen = 0;
+
         // search info
-        chess::Board s_board{};
         search_param s_param{};
-        bool s_verbose{};
 
         // search result
         search_result s_result{};
+        // when this thread entered its last search, see [lazysmp::go_time]
+        std::chrono::steady_clock::time_point s_started{};
 
         lazysmp *parent = nullptr;
+        table *tt = nullptr;
+        endgame_table *endgame = nullptr;
+        const nnue2::network_view *network = nullptr;
+        // the weights of [network], or this node's replica of them
+        const void *weights = nullptr;
+
+        search_thread(int index, int node, lazysmp *parent, table *tt, endgame_table *endgame,
+                      const nnue2::network_view *network, const void *weights)
+            : index(index), node(node), seen(parent->epoch.load()), parent{parent}, tt{tt},
+              endgame{endgame}, network{network}, weights{weights}
+        {
+        }
 
-        search_thread(int index, lazysmp *parent, table *tt, endgame_table *endgame,
-                      nnue2::net *net)
-            : nnue{new nnue2::net{net->clone()}},
-              end{endgame != nullptr ? new endgame_table{endgame->clone()} : nullptr}, index(index),
-              parent{parent}
+        // runs on the search thread, so first touch puts its state on the thread's own node
+        void init()
         {
-            eng = new engine{end, nnue, tt};
+            if (node >= 0)
+                numa::bind_thread(node);
+
+            nnue = network->make_net(weights, global::large_pages);
+            end = endgame != nullptr ? new endgame_table{endgame->clone()} : nullptr;
+            eng = new engine{end, nnue.get(), tt};
+            eng->m_timer.share_stop(&parent->stop_flag);
+            eng->m_counters = &parent->counters;
+            eng->m_busy = &parent->busy;
+
+            mutex.lock();
+            is_ready = true;
+            mutex.unlock();
+            cv.notify_all();
+        }
+
+        void wait_ready()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [&] { return is_ready.load(); });
         }
 
         bool is_main_thread() const
@@ -46,44 +81,46 @@ struct lazysmp
 
         void loop()
         {
+            init();
+
             while (true)
             {
                 eng->post_search_smp();
 
-                std::unique_lock<std::mutex> lock{mutex};
-                cv.wait(lock, [&] { return is_searching || should_quit; });
+                seen = parent->wait_epoch(seen);
                 if (should_quit)
+                {
+                    parent->job_done();
                     break;
+                }
 
-                // do work
-                s_param.is_main_thread = is_main_thread();
-                s_param.thread_index = index;
-                s_param.main_thread_index = parent->main_thread_index;
-                s_result = eng->search(s_board, s_param, s_verbose);
-
-                // stop other threads if main thread exits
-                if (is_main_thread())
+                if (parent->job == job_kind::TASK)
                 {
-                    parent->stop();
+                    (*parent->job_task)(*this);
+                    parent->job_done();
+                    continue;
                 }
 
-                is_searching = false;
-                cv.notify_all();
-            }
-        }
+                if (parent->job == job_kind::SEARCH)
+                {
+                    s_started = std::chrono::steady_clock::now();
 
-        void start_search(const chess::Board &reference, search_param param, bool verbose = false)
-        {
-            assert(!is_searching);
+                    // do work
+                    s_param = parent->job_param;
+                    s_param.is_main_thread = is_main_thread();
+                    s_param.thread_index = index;
+                    s_param.main_thread_index = parent->main_thread_index;
+                    s_result = eng->search(parent->job_board, s_param, parent->job_verbose);
 
-            mutex.lock();
-            s_board = reference;
-            s_param = param;
-            s_verbose = verbose;
+                    // stop other threads if main thread exits
+                    if (is_main_thread())
+                    {
+                        parent->stop();
+                    }
+                }
 
-            is_searching = true;
-            mutex.unlock();
-            cv.notify_all();
+                parent->job_done();
+            }
         }
 
         void ponderhit(const chess::Board &reference, search_param param, bool verbose = false)
@@ -93,87 +130,140 @@ struct lazysmp
             eng->ponderhit(reference, param, verbose && is_main_thread());
         }
 
-        void wait_search()
-        {
-            std::unique_lock<std::mutex> lock{mutex};
-            cv.wait(lock, [&] { return !is_searching; });
-        }
-
-        void stop()
-        {
-            if (is_searching)
-            {
-                eng->m_timer.stop();
-            }
-        }
-
-        void quit()
-        {
-            mutex.lock();
-            should_quit = true;
-            stop();
-            mutex.unlock();
-            cv.notify_all();
-        }
-
         ~search_thread()
         {
-            if (!should_quit)
-                quit();
-
             delete eng;
             delete end;
-            delete nnue;
         }
     };
 
-    nnue2::net *net = nullptr;
+    const nnue2::network_view *network = nullptr;
     table *tt = nullptr;
     endgame_table *endgame = nullptr;
 
+    // one copy of the weights per node with numa::policy::REPLICATE
+    std::vector<memory::block> replicas;
+
     // thread stuff
-    int num_threads = 1;
+    int num_threads = 0;
     std::vector<std::unique_ptr<search_thread>> search_threads;
     std::vector<pthread_t> threads;
     int main_thread_index = 0;
 
-    lazysmp(int num, nnue2::net *net, table *tt, endgame_table *endgame)
-        : net(net), tt(tt), endgame(endgame), num_threads{num}
+    // summed over all threads for the last search
+    engine_stats last_stats{};
+
+    // go to search entry of the last search in microseconds, averaged and worst over threads
+    double last_start_mean = 0;
+    double last_start_worst = 0;
+
+    lazysmp(int num, const nnue2::network_view *network, table *tt, endgame_table *endgame)
+        : network(network), tt(tt), endgame(endgame)
     {
-        if (num_threads == 0)
+        if (num == 0)
             exit(0);
 
-        // make threads
-        for (int i = 0; i < num_threads; ++i)
-        {
-            search_threads.push_back(std::make_unique<search_thread>(i, this, tt, endgame, net));
-
-            pthread_t thread;
-            pthread_attr_t attr;
-            pthread_attr_init(&attr);
-            size_t stack_size = 4 * 1024 * 1024;
-            pthread_attr_setstacksize(&attr, stack_size);
-            pthread_create(
-                &thread, &attr,
-                [](void *t) {
-                    static_cast<search_thread *>(t)->loop();
-                    return static_cast<void *>(nullptr);
-                },
-                search_threads[i].get());
-
-            pthread_attr_destroy(&attr);
-            threads.push_back(thread);
-        }
+        make_replicas();
+        resize(num);
     }
 
     ~lazysmp()
     {
-        quit();
+        resize(0);
 
-        for (int i = 0; i < num_threads; ++i)
+        // threads are gone, nothing points at the copies anymore
+        for (auto &block : replicas)
+            memory::release(block);
+    }
+
+    // adds or removes threads at the end, the others keep their state
+    void resize(int num)
+    {
+        if (num < num_threads)
+        {
+            for (int i = num; i < num_threads; ++i)
+                search_threads[i]->should_quit = true;
+
+            // everyone wakes, the marked threads leave their loop
+            job = job_kind::NONE;
+            broadcast();
+            wait_done();
+
+            for (int i = num; i < num_threads; ++i)
+                pthread_join(threads[i], nullptr);
+
+            threads.resize(num);
+            search_threads.resize(num);
+            num_threads = num;
+        }
+
+        while (num_threads < num)
         {
-            pthread_join(threads[i], nullptr);
+            spawn(num_threads);
+            num_threads++;
         }
+
+        if (main_thread_index >= num_threads)
+            main_thread_index = 0;
+
+        spin_limit = num_threads < (int)std::thread::hardware_concurrency() ? SPIN_LIMIT : 0;
+
+        counters.counters.clear();
+        for (auto &thread : search_threads)
+            counters.counters.push_back(&thread->eng->m_nodes);
+    }
+
+    // runs [task] on every thread at once and waits for all of them, the work happens on the
+    // threads themselves so first touch keeps their state on their own node
+    void run_all(const std::function<void(search_thread &)> &task)
+    {
+        job = job_kind::TASK;
+        job_task = &task;
+        broadcast();
+        wait_done();
+    }
+
+    // forgets the last game, each thread clears its own tables and a slice of the tt
+    void new_game()
+    {
+        tt->m_generation = 0;
+        const size_t buckets = tt->m_size;
+        run_all([&](search_thread &t) {
+            tt->clear_range(buckets * t.index / num_threads, buckets * (t.index + 1) / num_threads);
+            t.eng->new_game();
+        });
+    }
+
+    // rebuilds each thread's net for new weights, the caller frees the old ones afterwards
+    void set_network(const nnue2::network_view *new_network)
+    {
+        network = new_network;
+
+        std::vector<memory::block> old_replicas = std::move(replicas);
+        replicas.clear();
+        make_replicas();
+
+        run_all([&](search_thread &t) {
+            t.network = network;
+            t.weights = weights_for(t.node);
+            t.nnue = network->make_net(t.weights, global::large_pages);
+            t.eng->set_nnue(t.nnue.get());
+        });
+
+        for (auto &block : old_replicas)
+            memory::release(block);
+    }
+
+    // [new_endgame] may be null, the caller frees the old table afterwards
+    void set_endgame(endgame_table *new_endgame)
+    {
+        endgame = new_endgame;
+        run_all([&](search_thread &t) {
+            delete t.end;
+            t.endgame = endgame;
+            t.end = endgame != nullptr ? new endgame_table{endgame->clone()} : nullptr;
+            t.eng->m_endgame = t.end;
+        });
     }
 
     search_result search(const chess::Board &reference, search_param param, bool verbose = false)
@@ -184,14 +274,28 @@ struct lazysmp
         if (verbose && num_threads > 1)
             std::cout << "info lazysmp with " << num_threads << " threads\n";
 
+        job = job_kind::SEARCH;
+        job_board = reference;
+        job_param = param;
+        job_verbose = verbose;
+        stop_flag.store(false);
+        // a thread that starts late must not show the last search's nodes to the others
+        for (auto &thread : search_threads)
+            thread->eng->m_nodes.store(0, std::memory_order_relaxed);
+
+        go_time = std::chrono::steady_clock::now();
+        broadcast();
+        wait_done();
+
+        last_start_mean = 0;
+        last_start_worst = 0;
         for (int i = 0; i < num_threads; ++i)
         {
-            search_threads[i]->start_search(reference, param, verbose);
-        }
-
-        for (int i = 0; i < num_threads; ++i)
-        {
-            search_threads[i]->wait_search();
+            const double us = std::chrono::duration<double, std::micro>(
+                                  search_threads[i]->s_started - go_time)
+                                  .count();
+            last_start_mean += us / num_threads;
+            last_start_worst = std::max(last_start_worst, us);
         }
 
         // thread voting
@@ -265,16 +369,29 @@ struct lazysmp
         main_thread_index = best_thread;
 
         auto result = search_threads[main_thread_index]->s_result;
+
+        last_stats = get_stats(0);
+        for (int i = 1; i < num_threads; ++i)
+            last_stats = last_stats.append(get_stats(i));
+
         if (verbose && num_threads > 1)
         {
-            engine_stats stats = get_stats(0);
-            for (int i = 1; i < num_threads; ++i)
-                stats = stats.append(get_stats(i));
-
             std::cout << "info lazysmp " << main_thread_index << " ";
-            stats.display_uci(result);
+            last_stats.display_uci(result);
         }
 
+        if (verbose && global::eval_stats)
+        {
+            last_stats.display_eval_cache();
+            if (global::lazy_eval)
+                last_stats.display_lazy_eval();
+        }
+
+#ifdef TDCHESS_TT_STATS
+        if (verbose)
+            last_stats.tt.display();
+#endif
+
         return result;
     }
 
@@ -286,24 +403,180 @@ struct lazysmp
         }
     }
 
-    void quit()
+    // every thread polls the same flag, so one store stops them all
+    void stop()
     {
-        for (int i = 0; i < num_threads; ++i)
+        stop_flag.store(true, std::memory_order_relaxed);
+    }
+
+    engine_stats get_stats(int index = 0) const
+    {
+        return search_threads[index]->eng->m_stats;
+    }
+
+    // every thread holds the same state
+    void display_footprint() const
+    {
+        search_threads[0]->eng->display_footprint();
+    }
+
+  private:
+    // what woken threads do, written before [broadcast] and read after the epoch moves
+    enum class job_kind
+    {
+        NONE,
+        SEARCH,
+        TASK,
+    };
+
+    job_kind job = job_kind::NONE;
+    chess::Board job_board{};
+    search_param job_param{};
+    bool job_verbose = false;
+    const std::function<void(search_thread &)> *job_task = nullptr;
+    std::chrono::steady_clock::time_point go_time{};
+
+    // the stop word of every thread's timer, see [timer::share_stop]
+    alignas(64) std::atomic<bool> stop_flag = false;
+
+    node_counters counters{};
+
+    // see global::abdada
+    busy_table busy{};
+
+    // idle threads spin on [epoch] for a while before parking on [pool_cv], so a go that comes
+    // soon after the last one starts every thread with a single store and no syscalls, spinning
+    // is off when the pool and the caller do not fit on the cores since it takes them from work
+    static constexpr int SPIN_LIMIT = 1 << 14;
+    std::atomic<int> spin_limit = 0;
+
+    alignas(64) std::atomic<uint64_t> epoch = 0;
+    std::atomic<int> parked = 0;
+    std::mutex pool_mutex{};
+    std::condition_variable pool_cv{};
+
+    // threads yet to finish the current job, the last one wakes the caller
+    alignas(64) std::atomic<int> pending = 0;
+    std::atomic<bool> caller_parked = false;
+    std::mutex done_mutex{};
+    std::condition_variable done_cv{};
+
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        asm volatile("yield");
+#endif
+    }
+
+    // starts [job] on every thread
+    void broadcast()
+    {
+        pending.store(num_threads);
+        epoch.fetch_add(1);
+
+        // parked threads recheck the epoch under the mutex, taking it here means none of them
+        // can miss the notify
+        if (parked.load() > 0)
         {
-            search_threads[i]->quit();
+            {
+                std::lock_guard<std::mutex> lock{pool_mutex};
+            }
+            pool_cv.notify_all();
         }
     }
 
-    void stop()
+    // blocks a thread until the epoch moves past [seen], returns the new one
+    uint64_t wait_epoch(uint64_t seen)
     {
-        for (int i = 0; i < num_threads; ++i)
+        const int limit = spin_limit.load(std::memory_order_relaxed);
+        for (int i = 0; i < limit; ++i)
         {
-            search_threads[i]->stop();
+            const uint64_t current = epoch.load(std::memory_order_acquire);
+            if (current != seen)
+                return current;
+            cpu_relax();
         }
+
+        parked.fetch_add(1);
+        std::unique_lock<std::mutex> lock{pool_mutex};
+        pool_cv.wait(lock, [&] { return epoch.load() != seen; });
+        parked.fetch_sub(1);
+        return epoch.load();
     }
 
-    engine_stats get_stats(int index = 0) const
+    void job_done()
     {
-        return search_threads[index]->eng->m_stats;
+        if (pending.fetch_sub(1) == 1 && caller_parked.load())
+        {
+            {
+                std::lock_guard<std::mutex> lock{done_mutex};
+            }
+            done_cv.notify_all();
+        }
+    }
+
+    void wait_done()
+    {
+        const int limit = spin_limit.load(std::memory_order_relaxed);
+        for (int i = 0; i < limit; ++i)
+        {
+            if (pending.load(std::memory_order_acquire) == 0)
+                return;
+            cpu_relax();
+        }
+
+        caller_parked = true;
+        std::unique_lock<std::mutex> lock{done_mutex};
+        done_cv.wait(lock, [&] { return pending.load() == 0; });
+        caller_parked = false;
+    }
+
+    void make_replicas()
+    {
+        if (!numa::is_active(global::numa_policy) ||
+            global::numa_policy != numa::policy::REPLICATE)
+            return;
+
+        for (int n = 0; n < numa::node_count(); ++n)
+        {
+            auto block = memory::allocate(network->size(), global::large_pages);
+            numa::bind_memory(block.ptr, block.size, n);
+            std::memcpy(block.ptr, network->get(), network->size());
+            replicas.push_back(block);
+        }
+    }
+
+    // the weights threads on [node] read, their node's replica if there is one
+    const void *weights_for(int node) const
+    {
+        return replicas.empty() ? network->get() : replicas[node].ptr;
+    }
+
+    void spawn(int i)
+    {
+        int node = numa::is_active(global::numa_policy) ? numa::node_for_thread(i) : -1;
+        search_threads.push_back(std::make_unique<search_thread>(i, node, this, tt, endgame,
+                                                                 network, weights_for(node)));
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        size_t stack_size = 4 * 1024 * 1024;
+        pthread_attr_setstacksize(&attr, stack_size);
+        pthread_create(
+            &thread, &attr,
+            [](void *t) {
+                static_cast<search_thread *>(t)->loop();
+                return static_cast<void *>(nullptr);
+            },
+            search_threads[i].get());
+
+        pthread_attr_destroy(&attr);
+        threads.push_back(thread);
+
+        // one at a time, engine construction also fills shared lookup tables
+        search_threads[i]->wait_ready();
     }
 };
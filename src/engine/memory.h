@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace memory
+{
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+constexpr size_t DEFAULT_ALIGNMENT = 1 << 14;
+
+enum class page_kind
+{
+    NORMAL,
+    TRANSPARENT_HUGE,
+    EXPLICIT_HUGE
+};
+
+inline const char *page_kind_name(page_kind kind)
+{
+    switch (kind)
+    {
+    case page_kind::EXPLICIT_HUGE:
+        return "explicit huge pages";
+    case page_kind::TRANSPARENT_HUGE:
+        return "transparent huge pages";
+    default:
+        return "normal pages";
+    }
+}
+
+// a block of memory that remembers how it was obtained, so it can be released the same way
+struct block
+{
+    void *ptr = nullptr;
+    size_t size = 0;
+    page_kind kind = page_kind::NORMAL;
+};
+
+constexpr size_t round_up(size_t bytes, size_t alignment)
+{
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// try explicit hugetlb pages, then transparent huge pages, then normal pages
+// blocks smaller than a huge page always get normal pages, rounding them up would waste most
+// of a page each and drain the hugetlb pool the tt needs
+inline block allocate(size_t bytes, bool large_pages)
+{
+    block out{};
+
+#ifdef __linux__
+    if (large_pages && bytes >= HUGE_PAGE_SIZE)
+    {
+        size_t size = round_up(bytes, HUGE_PAGE_SIZE);
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+            return {ptr, size, page_kind::EXPLICIT_HUGE};
+
+        ptr = std::aligned_alloc(HUGE_PAGE_SIZE, size);
+        if (ptr != nullptr)
+        {
+            bool advised = madvise(ptr, size, MADV_HUGEPAGE) == 0;
+            return {ptr, size, advised ? page_kind::TRANSPARENT_HUGE : page_kind::NORMAL};
+        }
+    }
+#else
+    (void)large_pages;
+#endif
+
+    out.size = round_up(bytes, DEFAULT_ALIGNMENT);
+    out.ptr = std::aligned_alloc(DEFAULT_ALIGNMENT, out.size);
+    assert(out.ptr != nullptr);
+    return out;
+}
+
+inline void release(block &mem)
+{
+    if (mem.ptr == nullptr)
+        return;
+
+#ifdef __linux__
+    if (mem.kind == page_kind::EXPLICIT_HUGE)
+        munmap(mem.ptr, mem.size);
+    else
+        std::free(mem.ptr);
+#else
+    std::free(mem.ptr);
+#endif
+
+    mem = block{};
+}
+
+// single object living in a (possibly huge page backed) block
+template <typename T> class large_ptr
+{
+    block m_block{};
+    T *m_ptr = nullptr;
+
+  public:
+    large_ptr() = default;
+
+    template <typename... Args> explicit large_ptr(bool large_pages, Args &&...args)
+    {
+        m_block = allocate(sizeof(T), large_pages);
+        m_ptr = new (m_block.ptr) T(std::forward<Args>(args)...);
+    }
+
+    // constructs a [U] derived from [T], for when the type is only known at runtime
+    template <typename U, typename... Args> static large_ptr make(bool large_pages, Args &&...args)
+    {
+        large_ptr out;
+        out.m_block = allocate(sizeof(U), large_pages);
+        out.m_ptr = new (out.m_block.ptr) U(std::forward<Args>(args)...);
+        return out;
+    }
+
+    large_ptr(const large_ptr &) = delete;
+    large_ptr &operator=(const large_ptr &) = delete;
+
+    large_ptr(large_ptr &&other) noexcept
+        : m_block{std::exchange(other.m_block, {})}, m_ptr{std::exchange(other.m_ptr, nullptr)}
+    {
+    }
+
+    large_ptr &operator=(large_ptr &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            m_block = std::exchange(other.m_block, {});
+            m_ptr = std::exchange(other.m_ptr, nullptr);
+        }
+        return *this;
+    }
+
+    ~large_ptr()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        if (m_ptr != nullptr)
+            m_ptr->~T();
+
+        release(m_block);
+        m_ptr = nullptr;
+    }
+
+    T *get() const
+    {
+        return m_ptr;
+    }
+
+    T *operator->() const
+    {
+        return m_ptr;
+    }
+
+    T &operator*() const
+    {
+        return *m_ptr;
+    }
+
+    [[nodiscard]] page_kind kind() const
+    {
+        return m_block.kind;
+    }
+};
+
+} // namespace memory
@@ -176,6 +176,10 @@ class movegen
                     return m_pv_move;
                 }
 
+                // only the tt can hand us an illegal move, a 16 bit key collision
+                if (m_pv_move != chess::Move::NO_MOVE)
+                    TT_STAT(false_positives++);
+
                 break;
             }
 
@@ -287,7 +291,7 @@ class movegen
                     const int CHESSMAP_DEPTH_LIMIT = 8;
                     bool use_chessmap = m_depth < CHESSMAP_DEPTH_LIMIT && !in_check;
                     if (use_chessmap)
-                        chessmap->catchup(m_position);
+                        chessmap->evaluate_all(m_position);
 
                     for (int i = m_capture_end;; ++i)
                     {
@@ -380,7 +384,7 @@ class movegen
 
                         if (use_chessmap)
                         {
-                            score += chessmap->evaluate_cached(m_position, move) /
+                            score += chessmap->get_output(m_position, move) /
                                      (1 + m_depth);
                         }
 
@@ -470,7 +474,7 @@ class movegen
                 auto counter = get_counter();
 
                 if (m_depth >= -1)
-                    chessmap->catchup(m_position);
+                    chessmap->evaluate_all(m_position);
 
                 for (int i = m_capture_end;; ++i)
                 {
@@ -509,7 +513,7 @@ class movegen
                         continue;
                     }
 
-                    int32_t score = m_depth >= -1 ? chessmap->evaluate_cached(m_position, move) : 0;
+                    int32_t score = m_depth >= -1 ? chessmap->get_output(m_position, move) : 0;
 
                     // normal
                     score += m_heuristics
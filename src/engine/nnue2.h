@@ -1,25 +1,28 @@
 #pragma once
 
 #include "chess.h"
+#include "kernels.h"
+#include "memory.h"
 #include "param.h"
 #include "simd.h"
+#include <algorithm>
 #include <cinttypes>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <fstream>
-
-#if defined(__AVX2__)
-#include <immintrin.h>
-#else
-#include <arm_neon.h>
-#endif
+#include <iostream>
+#include <ostream>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
 
 namespace nnue2
 {
 
-constexpr int HL = 1536;
-constexpr int KINGS = 8;
-constexpr int OUTPUTS = 1;
 constexpr int QA = 403;
 constexpr int QB = 81;
 constexpr int SCALE = 400;
@@ -42,50 +45,193 @@ constexpr int GET_KING_BUCKET(int sq)
     return KING_BUCKET[sq];
 }
 
+// activations of the hidden layers are clipped to [0, LAYER_QA], their weights are int8 scaled
+// by 1 << LAYER_SHIFT
+constexpr int LAYER_QA = 127;
+constexpr int LAYER_SHIFT = 6;
+
+// dimensions as stored in a network file header
+struct dims
+{
+    uint32_t hl;
+    uint32_t kings;
+    uint32_t outputs;
+    // 0 for a single output layer
+    uint32_t l2;
+    uint32_t l3;
+
+    bool operator==(const dims &) const = default;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const dims &d)
+{
+    out << "hl " << d.hl << " kings " << d.kings << " outputs " << d.outputs;
+    if (d.l2 != 0)
+        out << " l2 " << d.l2 << " l3 " << d.l3;
+    return out;
+}
+
+// dimensions of one network, everything below is templated on it
+// without L2 the accumulators feed a single SCReLU output, otherwise
+// (2 * HL -> L2 -> L3 -> 1) clipped relu layers, with OUTPUTS material buckets either way
+template <int HL_, int KINGS_, int OUTPUTS_, int L2_ = 0, int L3_ = 0> struct shape
+{
+    static constexpr int HL = HL_;
+    static constexpr int KINGS = KINGS_;
+    static constexpr int OUTPUTS = OUTPUTS_;
+    static constexpr int L2 = L2_;
+    static constexpr int L3 = L3_;
+    static constexpr dims DIMS{HL, KINGS, OUTPUTS, L2, L3};
+
+    // either KING_BUCKET or no king buckets at all
+    static_assert(KINGS == 1 || KINGS == 8);
+    static_assert(HL % 64 == 0);
+    static_assert(L2 % 16 == 0 && (L2 == 0) == (L3 == 0));
+
+    static constexpr int king_bucket(int sq)
+    {
+        if constexpr (KINGS == 1)
+            return 0;
+        else
+            return GET_KING_BUCKET(sq);
+    }
+};
+
+// motor.bin and every network before sizes were configurable
+using default_shape = shape<1536, 8, 1>;
+// a narrow network for bullet, evaluates several times faster
+using small_shape = shape<512, 1, 1>;
+// a narrow accumulator with hidden layers on top, for the strength of a wider single layer
+using layered_shape = shape<512, 8, 8, 16, 32>;
+
+// the shapes compiled in, a network file picks one of them in its header
+template <typename... Shapes> struct shape_list
+{
+    // calls [f] with the shape matching [d], false if none does
+    template <typename F> static bool visit(const dims &d, F &&f)
+    {
+        return ((d == Shapes::DIMS ? (f(Shapes{}), true) : false) || ...);
+    }
+};
+
+using shapes = shape_list<default_shape, small_shape, layered_shape>;
+
 #define INCBIN_SILENCE_BITCODE_WARNING
 #include "../hpplib/incbin.h"
+// with one engine copy per instruction set only one of them embeds the nets
+// TDCHESS_EMBED_INT8 embeds motor8.bin, motor.bin converted to the int8 format by
+// tdchess_convert, instead of motor.bin itself
+#ifdef TDCHESS_EXTERN_NETS
+INCBIN_EXTERN(Embed2);
+#elif defined(TDCHESS_EMBED_INT8)
+INCBIN(Embed2, "../nets/motor8.bin");
+#else
 INCBIN(Embed2, "../nets/motor.bin");
+#endif
 
 // horizontally mirrored, king input buckets, output buckets, single layer nnue
-struct network
+// the layout motor.bin and older EVALFILEs use, evaluated as it is, [quantise] converts it
+template <typename Shape> struct legacy_network
 {
-    alignas(simd::ALIGN) int16_t feature_weights[KINGS][768][HL];
-    alignas(simd::ALIGN) int16_t feature_bias[HL];
+    alignas(simd::ALIGN) int16_t feature_weights[Shape::KINGS][768][Shape::HL];
+    alignas(simd::ALIGN) int16_t feature_bias[Shape::HL];
 
-    alignas(simd::ALIGN) int16_t output_weights[OUTPUTS][2 * HL];
-    int16_t output_bias[OUTPUTS];
+    alignas(simd::ALIGN) int16_t output_weights[Shape::OUTPUTS][2 * Shape::HL];
+    int16_t output_bias[Shape::OUTPUTS];
 };
 
-struct update
+// same network with int8 feature weights, widened and multiplied by [feature_scale] during
+// accumulator updates, which halves the bytes streamed per feature row
+template <typename Shape, bool Layered = (Shape::L2 > 0)> struct network
 {
-    chess::Square king_sq[2];
+    alignas(simd::ALIGN) int8_t feature_weights[Shape::KINGS][768][Shape::HL];
+    alignas(simd::ALIGN) int16_t feature_bias[Shape::HL];
 
-    std::pair<chess::Square, chess::Piece> add1;
-    std::pair<chess::Square, chess::Piece> add2;
-    std::pair<chess::Square, chess::Piece> sub1;
-    std::pair<chess::Square, chess::Piece> sub2;
+    alignas(simd::ALIGN) int16_t output_weights[Shape::OUTPUTS][2 * Shape::HL];
+    int16_t output_bias[Shape::OUTPUTS];
+    int16_t feature_scale;
+};
 
-    enum
-    {
-        MOVE,
-        CAPTURE,
-        CASTLE
-    } type;
+// the same feature transformer under int8 hidden layers, all indexed by output bucket first
+template <typename Shape> struct network<Shape, true>
+{
+    alignas(simd::ALIGN) int8_t feature_weights[Shape::KINGS][768][Shape::HL];
+    alignas(simd::ALIGN) int16_t feature_bias[Shape::HL];
+    int16_t feature_scale;
+
+    // [block of four inputs][L2][4], see kernels::sparse_affine
+    alignas(simd::ALIGN) int8_t l1_weights[Shape::OUTPUTS][2 * Shape::HL * Shape::L2];
+    alignas(simd::ALIGN) int32_t l1_bias[Shape::OUTPUTS][Shape::L2];
+
+    alignas(simd::ALIGN) int8_t l2_weights[Shape::OUTPUTS][Shape::L3][Shape::L2];
+    alignas(simd::ALIGN) int32_t l2_bias[Shape::OUTPUTS][Shape::L3];
+
+    alignas(simd::ALIGN) int8_t output_weights[Shape::OUTPUTS][Shape::L3];
+    int32_t output_bias[Shape::OUTPUTS];
+};
+
+// version 1 files have no dimensions and are always default_shape, version 2 files written
+// before hidden layers existed have zero l2 and l3
+constexpr uint32_t NETWORK_VERSION = 2;
+
+// precedes [network] in a file, 64 bytes so the weights stay aligned when mapped
+struct alignas(64) network_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    // all zero in version 1
+    dims shape;
 };
 
-struct accumulator
+static_assert(sizeof(network_header) == 64);
+constexpr char NETWORK_MAGIC[8] = {'T', 'D', 'N', 'N', 'U', 'E', '8', '\0'};
+
+// picks the smallest scale that fits every weight in int8, returns the largest rounding error
+template <typename Shape>
+inline int quantise(const legacy_network<Shape> &in, network<Shape> &out)
+{
+    int max_abs = 0;
+    for (const auto &bucket : in.feature_weights)
+        for (const auto &row : bucket)
+            for (int16_t w : row)
+                max_abs = std::max(max_abs, std::abs(static_cast<int>(w)));
+
+    const int scale = std::max(1, (max_abs + 126) / 127);
+    int max_error = 0;
+    for (int k = 0; k < Shape::KINGS; ++k)
+    {
+        for (int f = 0; f < 768; ++f)
+        {
+            for (int i = 0; i < Shape::HL; ++i)
+            {
+                const int w = in.feature_weights[k][f][i];
+                const int q = std::clamp(static_cast<int>(std::lround(double(w) / scale)), -127,
+                                         127);
+                out.feature_weights[k][f][i] = static_cast<int8_t>(q);
+                max_error = std::max(max_error, std::abs(q * scale - w));
+            }
+        }
+    }
+
+    std::memcpy(out.feature_bias, in.feature_bias, sizeof(out.feature_bias));
+    std::memcpy(out.output_weights, in.output_weights, sizeof(out.output_weights));
+    std::memcpy(out.output_bias, in.output_bias, sizeof(out.output_bias));
+    out.feature_scale = static_cast<int16_t>(scale);
+    return max_error;
+}
+
+template <int HL> struct accumulator
 {
     alignas(simd::ALIGN) int16_t vals[2][HL];
-    bool is_clean[2];
-    update up;
 };
 
 constexpr int FINNY_TABLE_ENTRIES = 1;
-struct finny_table
+template <typename Shape> struct finny_table
 {
     struct entry
     {
-        accumulator acc;
+        accumulator<Shape::HL> acc;
         // [side][color]
         chess::Bitboard bycolor[2][2];
         // [side][piece_type]
@@ -93,7 +239,7 @@ struct finny_table
     };
 
     // [is_mirrored][king_bucket]
-    entry ent[2][KINGS][FINNY_TABLE_ENTRIES];
+    entry ent[2][Shape::KINGS][FINNY_TABLE_ENTRIES];
 
     finny_table()
     {
@@ -107,380 +253,301 @@ struct finny_table
     }
 };
 
+// per thread evaluation state, the weights are shared read-only between all threads
+// the move stack does not depend on the shape, so making and unmaking moves stays a direct call
 struct net
 {
-    network m_network{};
-    accumulator m_side[param::MAX_DEPTH]{};
+    kernels::update m_updates[param::MAX_DEPTH]{};
+    // which ply each slot of the accumulator ring holds
+    kernels::ring_owners m_owners{};
     int m_head{0};
 
-    finny_table m_table{};
+    virtual ~net() = default;
 
-    net()
+    void make_move(const chess::Board &board, const chess::Move &move)
     {
-        clear();
+        assert(m_head < param::MAX_DEPTH);
+
+        m_head++;
+        m_owners.release(m_head, 0);
+        m_owners.release(m_head, 1);
+        kernels::record(m_updates[m_head], board, move);
     }
 
-    void incbin_load() const
+    void unmake_move()
     {
-        const unsigned char *data = gEmbed2Data;
-        if (gEmbed2Size != sizeof(network))
-        {
-            std::cout << gEmbed2Size << ", " << sizeof(network) << std::endl;
-            std::cout << "failed to load network\n";
-            exit(0);
-        }
-
-        std::memcpy((void *)&m_network, data, gEmbed2Size);
+        m_head--;
     }
 
-    bool load_network(const std::string &path)
-    {
-        std::ifstream file(path, std::ios::binary | std::ios::ate);
+    virtual int32_t evaluate(const chess::Board &ref) = 0;
+    // scores many unrelated positions from scratch, the finny table makes neighbours that share
+    // pieces cheap, the move stack has to be initialized again afterwards
+    virtual void evaluate_batch(std::span<const chess::Board> boards, std::span<int32_t> out) = 0;
+    virtual void catchup(const chess::Board &position) = 0;
+    virtual void initialize(const chess::Board &position) = 0;
+    virtual void clear() = 0;
+
+    // per thread bytes of the accumulator stack and of the finny table
+    virtual size_t stack_bytes() const = 0;
+    virtual size_t table_bytes() const = 0;
+};
 
-        if (!file.is_open())
-        {
-            std::cerr << "info failed to open " << path << std::endl;
-            return false;
-        }
+// [Weights] is [network] or, for int16 feature rows, [legacy_network]
+template <typename Shape, typename Weights = network<Shape>> struct net_impl final : net
+{
+    static constexpr int HL = Shape::HL;
+    static constexpr int KINGS = Shape::KINGS;
+    static constexpr int OUTPUTS = Shape::OUTPUTS;
 
-        // Sanity check: Does the file size match our struct size?
-        std::streamsize size = file.tellg();
-        if (size != sizeof(network))
-        {
-            std::cerr << "info size mismatch! File: " << size
-                      << " bytes, Struct: " << sizeof(network) << " bytes." << std::endl;
-            return false;
-        }
+    using row = std::remove_all_extents_t<decltype(Weights::feature_weights)>;
+    using catchup_job = kernels::catchup_job<row>;
 
-        // Go back to the start and read the whole thing
-        file.seekg(0, std::ios::beg);
-        if (file.read(reinterpret_cast<char *>(&m_network), sizeof(network)))
-        {
-            return true;
-        }
+    // positions whose output layer shares one pass over the weights
+    static constexpr size_t BATCH = 4;
+    static_assert(BATCH <= kernels::RING);
 
-        return false;
-    }
+    const Weights *m_network = nullptr;
+    // by kernels::ring_slot of the ply
+    accumulator<HL> m_side[kernels::RING]{};
 
-    [[nodiscard]] net clone() const
+    finny_table<Shape> m_table{};
+
+    explicit net_impl(const Weights *weights) : m_network{weights}
     {
-        net n{};
-        n.m_network = m_network;
-        n.clear();
-        return n;
+        clear();
     }
-
-    void make_move(const chess::Board &board, const chess::Move &move)
+    int32_t evaluate(const chess::Board &ref) override
     {
-        assert(m_head < param::MAX_DEPTH);
+        catchup(ref);
+        assert(m_owners.holds(m_head, 0));
 
-        m_head++;
-        m_side[m_head].is_clean[0] = m_side[m_head].is_clean[1] = false;
-        auto *update = &m_side[m_head].up;
+        const int bucket = output_bucket(ref);
+
+        const auto &head = m_side[kernels::ring_slot(m_head)];
+        const int16_t *us = head.vals[ref.sideToMove()];
+        const int16_t *them = head.vals[ref.sideToMove() ^ 1];
 
-        // new king pos
-        update->king_sq[0] = board.kingSq(chess::Color::WHITE);
-        update->king_sq[1] = board.kingSq(chess::Color::BLACK);
-        if (board.at(move.from()).type() == chess::PieceType::KING)
+        int32_t output;
+        if constexpr (Shape::L2 > 0)
         {
-            // check castle
-            if (move.typeOf() == chess::Move::CASTLING)
-            {
-                const bool king_side = move.to() > move.from();
-                const chess::Square king_to =
-                    chess::Square::castling_king_square(king_side, board.sideToMove());
-                update->king_sq[board.sideToMove()] = king_to;
-            }
-            else
-            {
-                update->king_sq[board.sideToMove()] = move.to();
-            }
+            output = propagate(us, them, bucket);
         }
-
-        chess::Piece from = board.at(move.from());
-        chess::Piece to = board.at(move.to());
-        bool is_capture = to != chess::Piece::NONE;
-        update->type = update::MOVE;
-        switch (move.typeOf())
+        else
         {
-        case chess::Move::NORMAL: {
-            update->add1 = {move.to(), from};
-            update->sub1 = {move.from(), from};
+            const int16_t *us_weights = m_network->output_weights[bucket];
+            const int16_t *them_weights = m_network->output_weights[bucket] + HL;
 
-            if (is_capture)
-            {
-                update->type = update::CAPTURE;
-                update->sub2 = {move.to(), to};
-            }
-            break;
+            output = finish(kernels::flatten<QA, HL>(us, us_weights) +
+                                kernels::flatten<QA, HL>(them, them_weights),
+                            bucket);
         }
-        case chess::Move::ENPASSANT: {
-            update->type = update::CAPTURE;
 
-            update->add1 = {move.to(), from};
-            update->sub1 = {move.from(), from};
+        return std::clamp((int)output, -param::NNUE_MAX, (int)param::NNUE_MAX);
+    }
 
-            update->sub2 = {move.to().ep_square(), board.at(move.to().ep_square())};
-            break;
-        }
-        case chess::Move::PROMOTION: {
-            update->add1 = {move.to(), chess::Piece{board.sideToMove(), move.promotionType()}};
-            update->sub1 = {move.from(), from};
+    void evaluate_batch(std::span<const chess::Board> boards, std::span<int32_t> out) override
+    {
+        assert(out.size() >= boards.size());
+
+        for (size_t start = 0; start < boards.size(); start += BATCH)
+        {
+            const size_t n = std::min(BATCH, boards.size() - start);
+            const chess::Board *tile = &boards[start];
 
-            if (is_capture)
+            int buckets[BATCH];
+            for (size_t j = 0; j < n; ++j)
             {
-                update->type = update::CAPTURE;
-                update->sub2 = {move.to(), to};
+                refresh(tile[j], chess::Color::WHITE, j);
+                refresh(tile[j], chess::Color::BLACK, j);
+                buckets[j] = output_bucket(tile[j]);
             }
-            break;
-        }
-        case chess::Move::CASTLING: {
-            const bool king_side = move.to() > move.from();
-            const chess::Square rook_to =
-                chess::Square::castling_rook_square(king_side, board.sideToMove());
-            const chess::Square king_to =
-                chess::Square::castling_king_square(king_side, board.sideToMove());
-
-            update->type = update::CASTLE;
-            update->add1 = {king_to, from};
-            update->sub1 = {move.from(), from};
-
-            update->add2 = {rook_to, to};
-            update->sub2 = {move.to(), to};
-            break;
-        }
-        default:
-            assert(false);
-        }
-    }
 
-    void unmake_move()
-    {
-        m_head--;
-    }
-    //
-    // uint16_t nnz_table[256][8]{};
-    //
-    // void init_nnz()
-    // {
-    //     std::memset(nnz_table, 0, sizeof(nnz_table));
-    //     for (int i = 0; i < 256; ++i)
-    //     {
-    //         unsigned int bits = i;
-    //         int j = 0;
-    //         while (bits)
-    //         {
-    //             int idx = __builtin_ctz(bits);
-    //             bits ^= (1 << idx);
-    //             nnz_table[i][j++] = idx;
-    //         }
-    //     }
-    // }
-    //
-    // uint8_t get_nnz_mask_s16(int16x8_t v)
-    // {
-    //     // Compare > 0: results in 0xFFFF for true, 0x0000 for false
-    //     uint16x8_t mask = vcgtq_s16(v, vdupq_n_s16(0));
-    //
-    //     // Narrow 16-bit lanes to 8-bit lanes (taking the top bit of each lane)
-    //     uint8x8_t narrowed = vshrn_n_u16(mask, 4);
-    //
-    //     // Apply bit weights: {1, 2, 4, 8, 16, 32, 64, 128}
-    //     const uint8x8_t weights = {1, 2, 4, 8, 16, 32, 64, 128};
-    //     uint8x8_t weighted = vand_u8(narrowed, weights);
-    //
-    //     // Horizontal add to get the final 8-bit mask
-    //     return vaddv_u8(weighted);
-    // }
-
-    int32_t evaluate(const chess::Board &ref)
-    {
-        catchup(ref);
-        assert(m_side[m_head].is_clean[0]);
+            const bool same_bucket =
+                std::all_of(buckets, buckets + n, [&](int b) { return b == buckets[0]; });
 
-        // compute output_bucket
-        // constexpr int divisor = (32 + OUTPUTS - 1) / OUTPUTS;
-        // int bucket = (ref.occ().count() - 2) / divisor;
-        int bucket = 0;
+            if constexpr (Shape::L2 == 0)
+            {
+                if (same_bucket)
+                {
+                    // a short tile repeats its last position, the extra results are dropped
+                    const int16_t *us[BATCH];
+                    const int16_t *them[BATCH];
+                    for (size_t j = 0; j < BATCH; ++j)
+                    {
+                        const size_t k = std::min(j, n - 1);
+                        us[j] = m_side[k].vals[tile[k].sideToMove()];
+                        them[j] = m_side[k].vals[tile[k].sideToMove() ^ 1];
+                    }
 
-#if defined(__AVX2__)
-        const __m256i *__restrict__ us = (__m256i *)(m_side[m_head].vals[ref.sideToMove()]);
-        const __m256i *__restrict__ them = (__m256i *)(m_side[m_head].vals[ref.sideToMove() ^ 1]);
+                    const int16_t *us_weights = m_network->output_weights[buckets[0]];
+                    const int16_t *them_weights = m_network->output_weights[buckets[0]] + HL;
 
-        const __m256i *__restrict__ us_weights = (__m256i *)(m_network.output_weights[bucket]);
-        const __m256i *__restrict__ them_weights =
-            (__m256i *)(m_network.output_weights[bucket] + HL);
+                    int32_t us_sum[BATCH];
+                    int32_t them_sum[BATCH];
+                    kernels::flatten_many<QA, HL, BATCH>(us, us_weights, us_sum);
+                    kernels::flatten_many<QA, HL, BATCH>(them, them_weights, them_sum);
 
-#else
+                    for (size_t j = 0; j < n; ++j)
+                        out[start + j] =
+                            std::clamp((int)finish(us_sum[j] + them_sum[j], buckets[0]),
+                                       -param::NNUE_MAX, (int)param::NNUE_MAX);
+                    continue;
+                }
+            }
 
-        const int16x8_t *__restrict__ us = (int16x8_t *)(m_side[m_head].vals[ref.sideToMove()]);
-        const int16x8_t *__restrict__ them =
-            (int16x8_t *)(m_side[m_head].vals[ref.sideToMove() ^ 1]);
+            for (size_t j = 0; j < n; ++j)
+            {
+                const int16_t *us = m_side[j].vals[tile[j].sideToMove()];
+                const int16_t *them = m_side[j].vals[tile[j].sideToMove() ^ 1];
 
-        const int16x8_t *__restrict__ us_weights = (int16x8_t *)(m_network.output_weights[bucket]);
-        const int16x8_t *__restrict__ them_weights =
-            (int16x8_t *)(m_network.output_weights[bucket] + HL);
+                int32_t output;
+                if constexpr (Shape::L2 > 0)
+                {
+                    output = propagate(us, them, buckets[j]);
+                }
+                else
+                {
+                    const int16_t *us_weights = m_network->output_weights[buckets[j]];
+                    const int16_t *them_weights = m_network->output_weights[buckets[j]] + HL;
+                    output = finish(kernels::flatten<QA, HL>(us, us_weights) +
+                                        kernels::flatten<QA, HL>(them, them_weights),
+                                    buckets[j]);
+                }
 
-#endif
-        int32_t output = flatten(us, us_weights) + flatten(them, them_weights);
+                out[start + j] = std::clamp((int)output, -param::NNUE_MAX, (int)param::NNUE_MAX);
+            }
+        }
+
+        // the scratch plies no longer match the move stack
+        for (size_t j = 0; j < BATCH; ++j)
+            m_owners.ply[j][0] = m_owners.ply[j][1] = -1;
+    }
+
+    static int output_bucket(const chess::Board &ref)
+    {
+        constexpr int divisor = (32 + OUTPUTS - 1) / OUTPUTS;
+        return (ref.occ().count() - 2) / divisor;
+    }
 
+    // single layer, the summed products of both perspectives to centipawns
+    int32_t finish(int32_t output, int bucket) const
+    {
         output /= QA;
-        output += m_network.output_bias[bucket];
+        output += m_network->output_bias[bucket];
 
         output *= SCALE;
         output /= QA * QB;
-
-        return std::clamp((int)output, -param::NNUE_MAX, (int)param::NNUE_MAX);
+        return output;
     }
 
-#if defined(__AVX2__)
-    int32_t flatten(const __m256i *__restrict__ acc, const __m256i *__restrict__ weight)
+    // the hidden layers, most clipped accumulator values are zero so the first one only
+    // multiplies the non-zero blocks of four
+    int32_t propagate(const int16_t *us, const int16_t *them, int bucket) const
     {
-        const __m256i vec_zero = _mm256_setzero_si256();
-        const __m256i vec_qa = _mm256_set1_epi16(QA);
-
-        __m256i sum = vec_zero;
-
-        // HL / 16 gives us the total number of __m256i blocks.
-        // We process 2 blocks (32 elements) per iteration.
-        for (int i = 0; i < (HL / 16); i += 2)
+        constexpr int L2 = Shape::L2;
+        constexpr int L3 = Shape::L3;
+        constexpr int BLOCKS = 2 * HL / 4;
+
+        // uint8 activations, read four at a time
+        alignas(simd::ALIGN) int32_t l1_blocks[BLOCKS];
+        auto *l1_in = reinterpret_cast<uint8_t *>(l1_blocks);
+        for (int i = 0; i < HL; ++i)
         {
-            // Prefetching next blocks
-            _mm_prefetch((const char *)&acc[i + 2], _MM_HINT_T0);
-            _mm_prefetch((const char *)&weight[i + 2], _MM_HINT_T0);
-
-            // Load 256-bit vectors via pointer dereference
-            const __m256i us = acc[i + 0];
-            const __m256i them = acc[i + 1];
-            const __m256i us_weights = weight[i + 0];
-            const __m256i them_weights = weight[i + 1];
-
-            // Clamp: min(max(x, 0), QA)
-            const __m256i us_clamped = _mm256_min_epi16(_mm256_max_epi16(us, vec_zero), vec_qa);
-            const __m256i them_clamped = _mm256_min_epi16(_mm256_max_epi16(them, vec_zero), vec_qa);
-
-            // Compute: (weight * clamped) then horizontal-multiply-add with clamped
-            // This effectively computes sum(weight * clamped^2) widened to 32-bit
-            const __m256i us_results =
-                _mm256_madd_epi16(_mm256_mullo_epi16(us_weights, us_clamped), us_clamped);
-            const __m256i them_results =
-                _mm256_madd_epi16(_mm256_mullo_epi16(them_weights, them_clamped), them_clamped);
-
-            sum = _mm256_add_epi32(sum, us_results);
-            sum = _mm256_add_epi32(sum, them_results);
+            l1_in[i] = static_cast<uint8_t>(std::clamp<int>(us[i], 0, LAYER_QA));
+            l1_in[HL + i] = static_cast<uint8_t>(std::clamp<int>(them[i], 0, LAYER_QA));
         }
 
-        // Final horizontal reduction: 256-bit -> 128-bit -> scalar int32
-        __m128i v_low = _mm256_castsi256_si128(sum);
-        __m128i v_high = _mm256_extracti128_si256(sum, 1);
-        __m128i res = _mm_add_epi32(v_low, v_high);
-
-        // Collapse 4x32-bit into 1x32-bit
-        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(0, 1, 2, 3)));
-        res = _mm_add_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 0, 1)));
+        alignas(simd::ALIGN) uint16_t nnz[BLOCKS];
+        const int count = kernels::find_nnz<BLOCKS>(l1_blocks, nnz);
 
-        return _mm_cvtsi128_si32(res);
-    }
-#else
-    int32_t flatten(const int16x8_t *__restrict__ acc, const int16x8_t *__restrict__ weight)
-    {
-        const int16x8_t v_zero = vdupq_n_s16(0);
-        const int16x8_t v_qa = vdupq_n_s16(QA);
+        alignas(simd::ALIGN) int32_t l1_out[L2];
+        kernels::sparse_affine<L2>(l1_blocks, nnz, count, m_network->l1_weights[bucket],
+                                   m_network->l1_bias[bucket], l1_out);
 
-        int32x4_t out0 = vdupq_n_s32(0);
-        int32x4_t out1 = vdupq_n_s32(0);
-        int32x4_t out2 = vdupq_n_s32(0);
-        int32x4_t out3 = vdupq_n_s32(0);
+        uint8_t l2_in[L2];
+        for (int i = 0; i < L2; ++i)
+            l2_in[i] = static_cast<uint8_t>(std::clamp(l1_out[i] >> LAYER_SHIFT, 0, LAYER_QA));
 
-        for (int i = 0; i < HL / 8; i += 2)
+        // small enough to leave to the compiler
+        uint8_t l3_in[L3];
+        for (int o = 0; o < L3; ++o)
         {
-            __builtin_prefetch(&acc[i + 2]);
-            __builtin_prefetch(&weight[i + 2]);
-
-            int16x8_t c0 = vminq_s16(vmaxq_s16(acc[i + 0], v_zero), v_qa);
-            int16x8_t c1 = vminq_s16(vmaxq_s16(acc[i + 1], v_zero), v_qa);
+            int32_t sum = m_network->l2_bias[bucket][o];
+            for (int i = 0; i < L2; ++i)
+                sum += l2_in[i] * m_network->l2_weights[bucket][o][i];
 
-            int16x8_t pm0 = vmulq_s16(c0, weight[i + 0]);
-            int16x8_t pm1 = vmulq_s16(c1, weight[i + 1]);
-
-            out0 = vmlal_s16(out0, vget_low_s16(pm0), vget_low_s16(c0));
-            out1 = vmlal_s16(out1, vget_low_s16(pm1), vget_low_s16(c1));
-            out2 = vmlal_high_s16(out2, pm0, c0);
-            out3 = vmlal_high_s16(out3, pm1, c1);
+            l3_in[o] = static_cast<uint8_t>(std::clamp(sum >> LAYER_SHIFT, 0, LAYER_QA));
         }
 
-        return vaddvq_s32(vaddq_s32(vaddq_s32(out0, out1), vaddq_s32(out2, out3)));
+        int32_t output = m_network->output_bias[bucket];
+        for (int i = 0; i < L3; ++i)
+            output += l3_in[i] * m_network->output_weights[bucket][i];
+
+        return output * SCALE / (LAYER_QA << LAYER_SHIFT);
     }
-#endif
 
-    void catchup(const chess::Board &position)
+    void catchup(const chess::Board &position) override
     {
+        catchup_job jobs[2];
+        int num_jobs = 0;
+
         for (int side = 0; side <= 1; ++side)
         {
-            if (m_side[m_head].is_clean[side])
+            if (m_owners.holds(m_head, side))
                 continue;
 
             int base = m_head;
             while (true)
             {
-                if (need_refresh(side, m_side[base].up.king_sq[side],
-                                 m_side[m_head].up.king_sq[side]) || m_head - base > 8)
+                // the root slot can be reused by a deep line, so the walk may run off the stack
+                if (base < 0 || m_head - base > kernels::MAX_CATCHUP ||
+                    need_refresh(side, m_updates[base].king_sq[side],
+                                 m_updates[m_head].king_sq[side]))
                 {
                     // full refresh head
                     refresh(position, side, m_head);
                     break;
                 }
 
-                if (m_side[base].is_clean[side])
+                if (m_owners.holds(base, side))
                 {
-                    for (int i = base + 1; i <= m_head; ++i)
-                    {
-                        update((simd::Vec *)m_side[i - 1].vals[side],
-                               (simd::Vec *)m_side[i].vals[side], m_side[i].up, side);
-                        m_side[i].is_clean[side] = true;
-                    }
-
-                    assert(m_side[m_head].is_clean[side]);
+                    collect(jobs[num_jobs++], static_cast<chess::Color>(side), base);
                     break;
                 }
 
                 base -= 1;
-                assert(base >= 0);
             }
         }
 
-        assert(m_side[m_head].is_clean[0] && m_side[m_head].is_clean[1]);
+        // both perspectives share one pass over HL
+        if (num_jobs > 0)
+            kernels::fused_catchup<HL>(jobs, num_jobs, feature_scale());
+
+        assert(m_owners.holds(m_head, 0) && m_owners.holds(m_head, 1));
     }
 
-    void update(simd::Vec *__restrict__ base, simd::Vec *__restrict__ next, const update &update,
-                chess::Color side)
+    void collect(catchup_job &job, chess::Color side, int base)
     {
-        switch (update.type)
+        job.in = (const simd::Vec *)m_side[kernels::ring_slot(base)].vals[side];
+        job.plies = m_head - base;
+
+        for (int p = 0; p < job.plies; ++p)
         {
-        case update::MOVE: {
-            fused_add_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first));
-            break;
-        }
-        case update::CAPTURE: {
-            fused_add_sub_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first),
-                feature_lookup(update.king_sq[side], side, update.sub2.second, update.sub2.first));
-            break;
-        }
-        case update::CASTLE: {
-            fused_add_add_sub_sub<HL>(
-                next, base,
-                feature_lookup(update.king_sq[side], side, update.add1.second, update.add1.first),
-                feature_lookup(update.king_sq[side], side, update.add2.second, update.add2.first),
-                feature_lookup(update.king_sq[side], side, update.sub1.second, update.sub1.first),
-                feature_lookup(update.king_sq[side], side, update.sub2.second, update.sub2.first));
-            break;
-        }
+            const int ply = base + 1 + p;
+            kernels::push_rows(job, p, m_updates[ply], side,
+                               [&](chess::Square king_sq, chess::Color s, chess::Piece piece,
+                                   chess::Square sq) {
+                                   return feature_lookup(king_sq, s, piece, sq);
+                               });
+
+            // the parent is where the next sibling starts from, older plies are rarely
+            // revisited before being overwritten, so only the last two are written back
+            const bool keep = p >= job.plies - 2;
+            job.outs[p] = keep ? (simd::Vec *)m_side[kernels::ring_slot(ply)].vals[side] : nullptr;
+            if (keep)
+                m_owners.claim(ply, side);
+            else
+                m_owners.release(ply, side);
         }
     }
 
@@ -488,7 +555,7 @@ struct net
     {
         // finny table refresh
         chess::Square king_sq = board.kingSq(side);
-        int bucket = GET_KING_BUCKET(king_sq.relative_square(side).index());
+        int bucket = Shape::king_bucket(king_sq.relative_square(side).index());
         assert(king_sq.file() == king_sq.relative_square(side).file());
         int is_mirrored = king_sq.file() >= chess::File::FILE_E;
 
@@ -527,22 +594,23 @@ struct net
             }
         }
 
-        fused_copy<HL>((simd::Vec *)m_side[index].vals[side], (simd::Vec *)ref->acc.vals[side]);
+        kernels::fused_copy<HL>((simd::Vec *)m_side[kernels::ring_slot(index)].vals[side],
+                                (simd::Vec *)ref->acc.vals[side]);
         memcpy(&ref->bycolor[side], &board.occ_bb_, sizeof(ref->bycolor[0]));
         memcpy(&ref->bypiece[side], &board.pieces_bb_, sizeof(ref->bypiece[0]));
-        m_side[index].is_clean[side] = true;
+        m_owners.claim(index, side);
     }
 
-    void initialize(const chess::Board &position)
+    void initialize(const chess::Board &position) override
     {
         m_head = 0;
-        m_side[0].up.king_sq[0] = position.kingSq(chess::Color::WHITE);
-        m_side[0].up.king_sq[1] = position.kingSq(chess::Color::BLACK);
+        m_updates[0].king_sq[0] = position.kingSq(chess::Color::WHITE);
+        m_updates[0].king_sq[1] = position.kingSq(chess::Color::BLACK);
         refresh(position, chess::Color::WHITE, 0);
         refresh(position, chess::Color::BLACK, 0);
     }
 
-    void clear()
+    void clear() override
     {
         m_table.clear();
         for (auto &a : m_table.ent)
@@ -551,15 +619,25 @@ struct net
             {
                 for (auto &en : b)
                 {
-                    fused_copy<HL>((simd::Vec *)en.acc.vals[0],
-                                   (simd::Vec *)m_network.feature_bias);
-                    fused_copy<HL>((simd::Vec *)en.acc.vals[1],
-                                   (simd::Vec *)m_network.feature_bias);
+                    kernels::fused_copy<HL>((simd::Vec *)en.acc.vals[0],
+                                            (const simd::Vec *)m_network->feature_bias);
+                    kernels::fused_copy<HL>((simd::Vec *)en.acc.vals[1],
+                                            (const simd::Vec *)m_network->feature_bias);
                 }
             }
         }
     }
 
+    size_t stack_bytes() const override
+    {
+        return sizeof(m_side) + sizeof(m_updates) + sizeof(m_owners);
+    }
+
+    size_t table_bytes() const override
+    {
+        return sizeof(m_table);
+    }
+
   private:
     static bool need_refresh(chess::Color side, chess::Square old_king, chess::Square new_king)
     {
@@ -569,95 +647,330 @@ struct net
         if ((old_king.index() & 0b100) != (new_king.index() & 0b100))
             return true;
 
-        return GET_KING_BUCKET(old_king.relative_square(side).index()) !=
-               GET_KING_BUCKET(new_king.relative_square(side).index());
+        return Shape::king_bucket(old_king.relative_square(side).index()) !=
+               Shape::king_bucket(new_king.relative_square(side).index());
+    }
+
+    // int16 rows ignore it
+    simd::Vec feature_scale() const
+    {
+        if constexpr (std::is_same_v<row, int8_t>)
+            return simd::set16(m_network->feature_scale);
+        else
+            return simd::set16(1);
     }
 
-    simd::Vec *feature_lookup(chess::Square king_sq, chess::Color side, chess::Piece piece,
-                              chess::Square square)
+    const row *feature_lookup(chess::Square king_sq, chess::Color side, chess::Piece piece,
+                              chess::Square square) const
     {
         // mirror if king on right
         if (king_sq.index() & 0b100)
             square = chess::Square{square.index() ^ 7};
 
-        return reinterpret_cast<simd::Vec *>(
-            m_network.feature_weights[GET_KING_BUCKET(king_sq.relative_square(side).index())]
-                                     [((piece.color() == side ? 0 : 6) + piece.type()) * 64 +
-                                      square.relative_square(side).index()]);
+        return m_network
+            ->feature_weights[Shape::king_bucket(king_sq.relative_square(side).index())]
+                             [((piece.color() == side ? 0 : 6) + piece.type()) * 64 +
+                              square.relative_square(side).index()];
     }
 
   private:
     /// accumulator functions ///
 
-    void acc_add_piece(accumulator &acc, chess::Color side, chess::Square king_sq,
+    void acc_add_piece(accumulator<HL> &acc, chess::Color side, chess::Square king_sq,
                        chess::Piece piece, chess::Square square)
     {
-        fused_add<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
-                      feature_lookup(king_sq, side, piece, square));
+        kernels::fused_add<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
+                               feature_lookup(king_sq, side, piece, square),
+                               feature_scale());
     }
 
-    void acc_remove_piece(accumulator &acc, chess::Color side, chess::Square king_sq,
+    void acc_remove_piece(accumulator<HL> &acc, chess::Color side, chess::Square king_sq,
                           chess::Piece piece, chess::Square square)
     {
-        fused_sub<HL>((simd::Vec *)(acc.vals[side]), (simd::Vec *)(acc.vals[side]),
-                      feature_lookup(king_sq, side, piece, square));
+        kernels::fused_sub<HL>((simd::Vec *)(acc.vals[side]), (simd::Vec *)(acc.vals[side]),
+                               feature_lookup(king_sq, side, piece, square),
+                               feature_scale());
     }
 
-    void acc_move_piece(accumulator &acc, chess::Color side, chess::Square king_sq,
+    void acc_move_piece(accumulator<HL> &acc, chess::Color side, chess::Square king_sq,
                         chess::Piece piece, chess::Square square_from, chess::Square square_to)
     {
-        fused_add_sub<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
-                          feature_lookup(king_sq, side, piece, square_to),
-                          feature_lookup(king_sq, side, piece, square_from));
+        kernels::fused_add_sub<HL>((simd::Vec *)acc.vals[side], (simd::Vec *)acc.vals[side],
+                                   feature_lookup(king_sq, side, piece, square_to),
+                                   feature_lookup(king_sq, side, piece, square_from),
+                                   feature_scale());
     }
+};
 
-    /// fused updates ///
+// read-only view of a network, either the embedded weights or a mapped EVALFILE, used in place
+class network_view
+{
+    const void *m_network = nullptr;
+    size_t m_size = 0;
+    // one of [shapes]
+    dims m_dims{};
+    // a [legacy_network] with int16 feature rows, like motor.bin
+    bool m_legacy = false;
+
+    // backing storage when not embedded
+    void *m_mapping = nullptr;
+    size_t m_mapping_size = 0;
+    memory::block m_copy{};
+
+  public:
+    network_view() = default;
+    network_view(const network_view &) = delete;
+    network_view &operator=(const network_view &) = delete;
+
+    ~network_view()
+    {
+        release();
+    }
 
-    template <size_t Size>
-    static void fused_copy(simd::Vec *__restrict__ out, const simd::Vec *__restrict__ in)
+    [[nodiscard]] const void *get() const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = in[i];
+        return m_network;
     }
 
-    template <size_t Size>
-    static void fused_add(simd::Vec *out, const simd::Vec *__restrict__ in, const simd::Vec *__restrict__ add)
+    [[nodiscard]] size_t size() const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::add16(in[i], add[i]);
+        return m_size;
     }
 
-    template <size_t Size>
-    static void fused_sub(simd::Vec *out, const simd::Vec *__restrict__ in, const simd::Vec *__restrict__ sub)
+    [[nodiscard]] const dims &dimensions() const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(in[i], sub[i]);
+        return m_dims;
     }
 
-    template <size_t Size>
-    static void fused_add_sub(simd::Vec *out, const simd::Vec *__restrict__ in, const simd::Vec *__restrict__ add,
-                              const simd::Vec *__restrict__ sub)
+    // evaluation state for this network's shape, reading [weights], which is either [get] or
+    // a copy of it
+    [[nodiscard]] memory::large_ptr<net> make_net(const void *weights, bool large_pages) const
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(simd::add16(in[i], add[i]), sub[i]);
+        if (m_legacy)
+        {
+            using legacy = legacy_network<default_shape>;
+            return memory::large_ptr<net>::make<net_impl<default_shape, legacy>>(
+                large_pages, static_cast<const legacy *>(weights));
+        }
+
+        memory::large_ptr<net> out;
+        shapes::visit(m_dims, [&](auto s) {
+            using S = decltype(s);
+            out = memory::large_ptr<net>::make<net_impl<S>>(
+                large_pages, static_cast<const network<S> *>(weights));
+        });
+
+        assert(out.get() != nullptr);
+        return out;
     }
 
-    template <size_t Size>
-    static void fused_add_sub_sub(simd::Vec *out, const simd::Vec *__restrict__ in, const simd::Vec *__restrict__ add,
-                                  const simd::Vec *__restrict__ sub1, const simd::Vec *__restrict__ sub2)
+    void incbin_load()
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(simd::sub16(simd::add16(in[i], add[i]), sub1[i]), sub2[i]);
+        if (!load_memory(gEmbed2Data, gEmbed2Size))
+        {
+            std::cout << gEmbed2Size << ", " << sizeof(network<default_shape>) << std::endl;
+            std::cout << "failed to load network\n";
+            exit(0);
+        }
     }
 
-    template <size_t Size>
-    static void fused_add_add_sub_sub(simd::Vec *out, const simd::Vec *__restrict__ in, const simd::Vec *__restrict__ add1,
-                                      const simd::Vec *__restrict__ add2, const simd::Vec *__restrict__ sub1,
-                                      const simd::Vec *__restrict__ sub2)
+    bool load_network(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            std::cerr << "info failed to open " << path << std::endl;
+            return false;
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(network_header))
+        {
+            std::cerr << "info size mismatch! File: " << st.st_size << " bytes, expected at least "
+                      << sizeof(network_header) << " bytes." << std::endl;
+            close(fd);
+            return false;
+        }
+
+        // page aligned, and shared through the page cache between processes
+        const size_t size = st.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "info failed to map " << path << std::endl;
+            return false;
+        }
+
+        madvise(mapping, size, MADV_WILLNEED);
+
+        if (!load_memory(mapping, size))
+        {
+            munmap(mapping, size);
+            return false;
+        }
+
+        // copies no longer need the file
+        if (m_copy.ptr != nullptr)
+        {
+            munmap(mapping, size);
+            return true;
+        }
+
+        m_mapping = mapping;
+        m_mapping_size = size;
+        return true;
+    }
+
+    // writes the current network in the int8 format, quantising int16 feature rows
+    bool save(const std::string &path) const
+    {
+        std::ofstream file{path, std::ios::binary};
+        if (!file.is_open() || m_network == nullptr)
+            return false;
+
+        const void *weights = m_network;
+        size_t size = m_size;
+        memory::block copy{};
+        if (m_legacy)
+        {
+            size = sizeof(network<default_shape>);
+            copy = memory::allocate(size, false);
+            auto *out = static_cast<network<default_shape> *>(copy.ptr);
+            int max_error =
+                quantise(*static_cast<const legacy_network<default_shape> *>(m_network), *out);
+            std::cout << "info string nnue quantised feature weights, scale "
+                      << out->feature_scale << " max error " << max_error << std::endl;
+            weights = copy.ptr;
+        }
+
+        network_header header{};
+        std::memcpy(header.magic, NETWORK_MAGIC, sizeof(NETWORK_MAGIC));
+        header.version = NETWORK_VERSION;
+        header.size = size;
+        header.shape = m_dims;
+
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(static_cast<const char *>(weights), size);
+        memory::release(copy);
+        return file.good();
+    }
+
+  private:
+    // bytes of a network with dimensions [d], 0 if that shape is not compiled in
+    static size_t network_size(const dims &d)
+    {
+        size_t size = 0;
+        shapes::visit(d, [&](auto s) { size = sizeof(network<decltype(s)>); });
+        return size;
+    }
+
+    // takes [data] in place when it is aligned, otherwise makes a copy, the int16 layout has
+    // no header and is told apart by its size
+    bool load_memory(const void *data, size_t size)
+    {
+        dims d = default_shape::DIMS;
+        const void *weights = data;
+        size_t weights_size = sizeof(legacy_network<default_shape>);
+        memory::block copy{};
+
+        const bool legacy = size == sizeof(legacy_network<default_shape>);
+        if (!legacy)
+        {
+            const auto *header = static_cast<const network_header *>(data);
+            if (size < sizeof(network_header) ||
+                std::memcmp(header->magic, NETWORK_MAGIC, sizeof(NETWORK_MAGIC)) != 0 ||
+                (header->version != 1 && header->version != NETWORK_VERSION))
+            {
+                std::cerr << "info unknown network format" << std::endl;
+                return false;
+            }
+
+            if (header->version != 1)
+                d = header->shape;
+
+            weights_size = network_size(d);
+            if (weights_size == 0 || header->size != weights_size ||
+                size != sizeof(network_header) + weights_size)
+            {
+                std::cerr << "info unsupported network shape " << d << std::endl;
+                return false;
+            }
+
+            weights = header + 1;
+        }
+
+        // incbin aligns to the widest vector of the target, copy only if that is not enough
+        if (reinterpret_cast<uintptr_t>(weights) % alignof(simd::Vec) != 0)
+        {
+            copy = memory::allocate(weights_size, false);
+            std::memcpy(copy.ptr, weights, weights_size);
+            weights = copy.ptr;
+        }
+
+        release();
+        m_copy = copy;
+        m_network = weights;
+        m_size = weights_size;
+        m_dims = d;
+        m_legacy = legacy;
+        return true;
+    }
+
+    void release()
+    {
+        if (m_mapping != nullptr)
+            munmap(m_mapping, m_mapping_size);
+
+        memory::release(m_copy);
+
+        m_network = nullptr;
+        m_size = 0;
+        m_legacy = false;
+        m_mapping = nullptr;
+        m_mapping_size = 0;
+    }
+};
+
+// per thread cache of raw network outputs, checked before any accumulator catchup
+// the zobrist key includes the side to move, so one entry covers one evaluation
+struct eval_cache
+{
+    // 16k entries * 8 bytes = 128 KB, small enough to stay in L2
+    static constexpr size_t SIZE = 1 << 14;
+
+    struct entry
+    {
+        uint32_t key;
+        int16_t score;
+    };
+
+    entry m_entries[SIZE]{};
+    uint64_t m_probes = 0;
+    uint64_t m_hits = 0;
+
+    bool probe(uint64_t hash, int32_t &score)
+    {
+        m_probes++;
+        const entry &e = m_entries[hash & (SIZE - 1)];
+        if (e.key != static_cast<uint32_t>(hash >> 32))
+            return false;
+
+        m_hits++;
+        score = e.score;
+        return true;
+    }
+
+    void store(uint64_t hash, int32_t score)
+    {
+        m_entries[hash & (SIZE - 1)] = {static_cast<uint32_t>(hash >> 32),
+                                        static_cast<int16_t>(score)};
+    }
+
+    void clear()
     {
-        for (size_t i = 0; i < Size / simd::WIDTH; ++i)
-            out[i] = simd::sub16(
-                simd::add16(simd::sub16(simd::add16(in[i], add1[i]), sub1[i]), add2[i]), sub2[i]);
+        std::memset(m_entries, 0, sizeof(m_entries));
+        m_probes = m_hits = 0;
     }
 };
 
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace numa
+{
+
+enum class policy
+{
+    // leave placement to the os
+    NONE,
+    // spread threads over nodes, keep their state local and interleave the tt
+    BIND,
+    // bind, plus one copy of the network weights per node
+    REPLICATE
+};
+
+inline const char *policy_name(policy p)
+{
+    switch (p)
+    {
+    case policy::BIND:
+        return "bind";
+    case policy::REPLICATE:
+        return "replicate";
+    default:
+        return "none";
+    }
+}
+
+inline bool parse_policy(const std::string &name, policy &out)
+{
+    for (policy p : {policy::NONE, policy::BIND, policy::REPLICATE})
+    {
+        if (name == policy_name(p))
+        {
+            out = p;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct node
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+// parses sysfs lists like "0-7,16-23"
+inline std::vector<int> parse_list(const std::string &list)
+{
+    std::vector<int> out;
+
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+
+        const std::string range = list.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+        if (!range.empty())
+        {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int i = first; i <= last; ++i)
+                out.push_back(i);
+        }
+
+        pos = end + 1;
+    }
+
+    return out;
+}
+
+inline std::string read_line(const std::string &path)
+{
+    std::ifstream file{path};
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// nodes with cpus the process may run on, read once, the first call must come before any thread
+// is bound so the mask is the one inherited from taskset or a cpuset
+inline const std::vector<node> &nodes()
+{
+    static const std::vector<node> cached = [] {
+        std::vector<node> out;
+
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool has_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        const std::string root = "/sys/devices/system/node/";
+        for (int id : parse_list(read_line(root + "online")))
+        {
+            // the mbind masks below are a single word
+            if (id >= 64)
+                break;
+
+            std::vector<int> cpus;
+            for (int cpu : parse_list(read_line(root + "node" + std::to_string(id) + "/cpulist")))
+            {
+                if (!has_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                    cpus.push_back(cpu);
+            }
+
+            if (!cpus.empty())
+                out.push_back({id, std::move(cpus)});
+        }
+#endif
+
+        if (out.empty())
+            out.push_back({0, {}});
+
+        return out;
+    }();
+
+    return cached;
+}
+
+inline int node_count()
+{
+    return static_cast<int>(nodes().size());
+}
+
+// nothing to place on a single node machine
+inline bool is_active(policy p)
+{
+    return p != policy::NONE && node_count() > 1;
+}
+
+// round robin, so even two threads end up on different sockets
+inline int node_for_thread(int index)
+{
+    return index % node_count();
+}
+
+// pins the calling thread to the allowed cpus of [node_index], its first touches then land there
+inline void bind_thread(int node_index)
+{
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : nodes()[node_index].cpus)
+        CPU_SET(cpu, &cpuset);
+
+    sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+#else
+    (void)node_index;
+#endif
+}
+
+#ifdef __linux__
+// from linux/mempolicy.h, spelled out to avoid depending on libnuma
+constexpr int MODE_BIND = 2;
+constexpr int MODE_INTERLEAVE = 3;
+
+inline void set_range_policy(void *ptr, size_t size, int mode, uint64_t mask)
+{
+    syscall(SYS_mbind, ptr, size, mode, &mask, sizeof(mask) * 8, 0);
+}
+#endif
+
+// pages of [ptr, ptr + size) alternate between all nodes, must be called before first touch
+inline void interleave(void *ptr, size_t size)
+{
+#ifdef __linux__
+    uint64_t mask = 0;
+    for (const node &n : nodes())
+        mask |= uint64_t(1) << n.id;
+
+    set_range_policy(ptr, size, MODE_INTERLEAVE, mask);
+#else
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+// pages of [ptr, ptr + size) live on [node_index], must be called before first touch
+inline void bind_memory(void *ptr, size_t size, int node_index)
+{
+#ifdef __linux__
+    set_range_policy(ptr, size, MODE_BIND, uint64_t(1) << nodes()[node_index].id);
+#else
+    (void)ptr;
+    (void)size;
+    (void)node_index;
+#endif
+}
+
+} // namespace numa
@@ -1,8 +1,9 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
-#if defined(__AVX2__)
+#if defined(__SSE4_1__)
 #include <immintrin.h>
 #else
 #include <arm_neon.h>
@@ -11,11 +12,56 @@
 namespace simd
 {
 
-#if defined(__AVX2__)
+// what this copy of the engine was compiled for, reported over uci
+#if defined(__AVX512BW__) && defined(__AVX512VNNI__)
+constexpr const char *ISA = "avx512-vnni";
+#elif defined(__AVX512BW__)
+constexpr const char *ISA = "avx512";
+#elif defined(__AVX2__) && defined(__BMI2__)
+constexpr const char *ISA = "avx2-bmi2";
+#elif defined(__AVX2__)
+constexpr const char *ISA = "avx2";
+#elif defined(__SSE4_1__)
+constexpr const char *ISA = "sse4.1";
+#else
+constexpr const char *ISA = "neon";
+#endif
+
+#if defined(__AVX512BW__)
+
+using Vec = __m512i;
+constexpr size_t WIDTH = 32;
+constexpr size_t ALIGN = 64;
+// vectors kept in registers by multi pass kernels
+constexpr size_t TILE = 16;
+
+inline __attribute__((always_inline)) Vec add16(Vec a, Vec b)
+{
+    return _mm512_add_epi16(a, b);
+}
+
+inline __attribute__((always_inline)) Vec sub16(Vec a, Vec b)
+{
+    return _mm512_sub_epi16(a, b);
+}
+
+inline __attribute__((always_inline)) Vec set16(int16_t x)
+{
+    return _mm512_set1_epi16(x);
+}
+
+// sign extends WIDTH int8 values and multiplies them by [scale]
+inline __attribute__((always_inline)) Vec widen8(const int8_t *src, Vec scale)
+{
+    return _mm512_mullo_epi16(_mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i *)src)),
+                              scale);
+}
+#elif defined(__AVX2__)
 
 using Vec = __m256i;
 constexpr size_t WIDTH = 16;
 constexpr size_t ALIGN = 64;
+constexpr size_t TILE = 8;
 
 inline __attribute__((always_inline)) Vec add16(Vec a, Vec b)
 {
@@ -26,11 +72,49 @@ inline __attribute__((always_inline)) Vec sub16(Vec a, Vec b)
 {
     return _mm256_sub_epi16(a, b);
 }
+
+inline __attribute__((always_inline)) Vec set16(int16_t x)
+{
+    return _mm256_set1_epi16(x);
+}
+
+inline __attribute__((always_inline)) Vec widen8(const int8_t *src, Vec scale)
+{
+    return _mm256_mullo_epi16(_mm256_cvtepi8_epi16(_mm_load_si128((const __m128i *)src)), scale);
+}
+#elif defined(__SSE4_1__)
+
+using Vec = __m128i;
+constexpr size_t WIDTH = 8;
+constexpr size_t ALIGN = 64;
+constexpr size_t TILE = 8;
+
+inline __attribute__((always_inline)) Vec add16(Vec a, Vec b)
+{
+    return _mm_add_epi16(a, b);
+}
+
+inline __attribute__((always_inline)) Vec sub16(Vec a, Vec b)
+{
+    return _mm_sub_epi16(a, b);
+}
+
+inline __attribute__((always_inline)) Vec set16(int16_t x)
+{
+    return _mm_set1_epi16(x);
+}
+
+inline __attribute__((always_inline)) Vec widen8(const int8_t *src, Vec scale)
+{
+    return _mm_mullo_epi16(_mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)src)), scale);
+}
 #else
 // needs this to prevent aliasing in evaluate/catchup
 using Vec __attribute__((may_alias)) = int16x8x4_t;
 constexpr size_t WIDTH = 32;
 constexpr size_t ALIGN = 64;
+// each Vec is 4 q registers
+constexpr size_t TILE = 4;
 
 inline __attribute__((always_inline)) Vec add16(Vec a, Vec b)
 {
@@ -44,5 +128,21 @@ inline __attribute__((always_inline)) Vec sub16(Vec a, Vec b)
             vsubq_s16(a.val[2], b.val[2]), vsubq_s16(a.val[3], b.val[3])};
 }
 
+inline __attribute__((always_inline)) Vec set16(int16_t x)
+{
+    const int16x8_t v = vdupq_n_s16(x);
+    return {v, v, v, v};
+}
+
+inline __attribute__((always_inline)) Vec widen8(const int8_t *src, Vec scale)
+{
+    const int8x16_t lo = vld1q_s8(src);
+    const int8x16_t hi = vld1q_s8(src + 16);
+    return {vmulq_s16(vmovl_s8(vget_low_s8(lo)), scale.val[0]),
+            vmulq_s16(vmovl_s8(vget_high_s8(lo)), scale.val[1]),
+            vmulq_s16(vmovl_s8(vget_low_s8(hi)), scale.val[2]),
+            vmulq_s16(vmovl_s8(vget_high_s8(hi)), scale.val[3])};
+}
+
 #endif
 } // namespace simd
@@ -1,10 +1,82 @@
 #pragma once
 
 #include "chess.h"
+#include "chess960.h"
+#include "memory.h"
 #include "param.h"
 
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <climits>
 #include <cmath>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#ifdef TDCHESS_TT_STATS
+#define TT_STAT(expr) (tt_stats.expr)
+#else
+#define TT_STAT(expr) ((void)0)
+#endif
+
+// per thread probe/store counters, only updated when built with TDCHESS_TT_STATS
+struct table_stats
+{
+    uint64_t probes = 0;
+    uint64_t hits = 0;
+    uint64_t cutoffs = 0;
+    uint64_t writes = 0;
+    uint64_t qsearch_writes = 0;
+    // why set() overwrote the slot, or kept it
+    uint64_t replace_exact = 0;
+    uint64_t replace_key = 0;
+    uint64_t replace_depth = 0;
+    uint64_t replace_age = 0;
+    uint64_t kept = 0;
+    // key matched but the stored move was illegal
+    uint64_t false_positives = 0;
+
+    [[nodiscard]] table_stats append(const table_stats &other) const
+    {
+        return {probes + other.probes,
+                hits + other.hits,
+                cutoffs + other.cutoffs,
+                writes + other.writes,
+                qsearch_writes + other.qsearch_writes,
+                replace_exact + other.replace_exact,
+                replace_key + other.replace_key,
+                replace_depth + other.replace_depth,
+                replace_age + other.replace_age,
+                kept + other.kept,
+                false_positives + other.false_positives};
+    }
+
+    void display() const
+    {
+        auto percent = [](uint64_t part, uint64_t total) {
+            return total == 0 ? 0.0 : 100.0 * double(part) / double(total);
+        };
+
+        std::cout << "info string tt probes " << probes << " hits " << hits << " ("
+                  << std::fixed << std::setprecision(1) << percent(hits, probes) << "%) cutoffs "
+                  << cutoffs << " writes " << writes << " qsearch " << qsearch_writes
+                  << " replace exact " << replace_exact << " key " << replace_key << " depth "
+                  << replace_depth << " age " << replace_age << " kept " << kept
+                  << " falsepos " << false_positives << std::defaultfloat << std::endl;
+    }
+};
+
+inline thread_local table_stats tt_stats{};
 
 struct table_entry_result
 {
@@ -101,6 +173,9 @@ struct table_entry_copy
                     can_use = true;
             }
 
+            if (can_use)
+                TT_STAT(cutoffs++);
+
             return {.hit = true,
                     .can_use = can_use,
                     .score = adj_score,
@@ -122,23 +197,24 @@ struct table_entry_copy
     }
 };
 
+// key is stored separately in the bucket so all keys of a bucket can be compared at once
 class table_entry
 {
   public:
-    BUCKET_HASH m_hash;
     int16_t m_score;
     int16_t m_static_eval;
     uint16_t m_best_move;
     int8_t m_depth;
     uint8_t m_mask;
 
-    [[nodiscard]] table_entry_copy make_copy() const
+    [[nodiscard]] table_entry_copy make_copy(BUCKET_HASH key) const
     {
-        return {m_hash, m_score, m_static_eval, m_best_move, m_depth, m_mask};
+        return {key, m_score, m_static_eval, m_best_move, m_depth, m_mask};
     }
 
-    void set(uint64_t hash, uint8_t flag, int16_t score, int32_t ply, int32_t depth,
-             const chess::Move &best_move, int16_t static_eval, bool is_pv, uint8_t age)
+    void set(BUCKET_HASH &m_hash, uint64_t hash, uint8_t flag, int16_t score, int32_t ply,
+             int32_t depth, const chess::Move &best_move, int16_t static_eval, bool is_pv,
+             uint8_t age)
     {
         if (best_move != chess::Move::NO_MOVE || !MATCHES(hash, m_hash))
         {
@@ -151,6 +227,17 @@ class table_entry
         if (flag == param::EXACT_FLAG || !MATCHES(hash, m_hash) ||
             (depth + 5 + 2 * is_pv > (m_depth + param::DEPTH_OFFSET)) || age_diff >= 1)
         {
+#ifdef TDCHESS_TT_STATS
+            if (flag == param::EXACT_FLAG)
+                tt_stats.replace_exact++;
+            else if (!MATCHES(hash, m_hash))
+                tt_stats.replace_key++;
+            else if (depth + 5 + 2 * is_pv > (m_depth + param::DEPTH_OFFSET))
+                tt_stats.replace_depth++;
+            else
+                tt_stats.replace_age++;
+#endif
+
             m_hash = BUCKET_HASH(hash);
             m_depth = int8_t(depth - param::DEPTH_OFFSET);
             m_static_eval = static_eval;
@@ -167,19 +254,25 @@ class table_entry
             m_score = score;
             m_mask = SET_AGE(age) | SET_FLAG(flag) | SET_PV(is_pv);
         }
+        else
+        {
+            TT_STAT(kept++);
+        }
     }
 };
 
-constexpr int NUM_BUCKETS = 3;
-struct alignas(32) bucket
+// one cache line, keys packed up front followed by the entry data
+constexpr int NUM_BUCKETS = 6;
+struct alignas(64) bucket
 {
+    BUCKET_HASH m_keys[NUM_BUCKETS];
     table_entry m_entries[NUM_BUCKETS];
 
     void clear()
     {
         for (size_t i = 0; i < NUM_BUCKETS; ++i)
         {
-            m_entries[i].m_hash = 0;
+            m_keys[i] = 0;
             m_entries[i].m_depth = param::UNINIT_DEPTH - param::DEPTH_OFFSET;
             m_entries[i].m_static_eval = param::VALUE_NONE;
             m_entries[i].m_score = param::VALUE_NONE;
@@ -190,17 +283,36 @@ struct alignas(32) bucket
         }
     }
 
-    std::pair<table_entry &, table_entry_copy> probe(const uint64_t hash, bool &bucket_hit,
-                                                     uint8_t age)
+    // bit i is set if key i matches
+    [[nodiscard]] uint32_t match_keys(BUCKET_HASH key) const
+    {
+#if defined(__SSE4_1__)
+        // the 128 bit load covers the keys and the start of the first entry, mask that off
+        const __m128i keys = _mm_load_si128(reinterpret_cast<const __m128i *>(m_keys));
+        const __m128i eq = _mm_cmpeq_epi16(keys, _mm_set1_epi16(static_cast<int16_t>(key)));
+        const uint32_t lanes = _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+#else
+        const uint16x8_t keys = vld1q_u16(m_keys);
+        const uint8x8_t eq = vmovn_u16(vceqq_u16(keys, vdupq_n_u16(key)));
+        const uint8x8_t weights = {1, 2, 4, 8, 16, 32, 64, 128};
+        const uint32_t lanes = vaddv_u8(vand_u8(eq, weights));
+#endif
+        return lanes & ((1u << NUM_BUCKETS) - 1);
+    }
+
+    std::pair<int, table_entry_copy> probe(const uint64_t hash, bool &bucket_hit, uint8_t age)
     {
+        TT_STAT(probes++);
+
         const BUCKET_HASH key = hash;
-        for (int i = 0; i < NUM_BUCKETS; ++i)
+        const uint32_t matches = match_keys(key);
+        if (matches)
         {
-            if (key == m_entries[i].m_hash)
-            {
-                bucket_hit = (m_entries[i].m_depth + param::DEPTH_OFFSET) != param::UNINIT_DEPTH;
-                return {m_entries[i], m_entries[i].make_copy()};
-            }
+            const int i = __builtin_ctz(matches);
+            bucket_hit = (m_entries[i].m_depth + param::DEPTH_OFFSET) != param::UNINIT_DEPTH;
+            if (bucket_hit)
+                TT_STAT(hits++);
+            return {i, m_entries[i].make_copy(m_keys[i])};
         }
 
         int best_slot = 0;
@@ -221,45 +333,165 @@ struct alignas(32) bucket
         }
 
         bucket_hit = false;
-        return {m_entries[best_slot], {}};
+        return {best_slot, {}};
     }
 
     void store(uint64_t hash, uint8_t flag, int16_t score, int32_t ply, int32_t depth,
                const chess::Move &best_move, int16_t static_eval, bool is_pv, uint8_t age,
-               table_entry &entry)
+               int slot)
     {
-        entry.set(hash, flag, score, ply, depth, best_move, static_eval, is_pv, age);
+        TT_STAT(writes++);
+        m_entries[slot].set(m_keys[slot], hash, flag, score, ply, depth, best_move, static_eval,
+                            is_pv, age);
     }
 };
 
+static_assert(sizeof(bucket) == 64);
+
+// bump whenever the bucket or entry layout changes, saved tables are raw bucket arrays
+constexpr uint32_t TABLE_LAYOUT_VERSION = 1;
+
+// padded to a page so the bucket array in a saved file can be mapped directly
+struct alignas(4096) table_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_size;
+    uint64_t size;
+    uint8_t generation;
+};
+
+constexpr char TABLE_FILE_MAGIC[8] = {'T', 'D', 'C', 'H', 'E', 'S', 'S', 'T'};
+
 class table
 {
   public:
     bucket *m_buckets = nullptr;
     size_t m_size;
     uint8_t m_generation;
+    memory::block m_memory{};
+    bool m_large_pages;
 
-    explicit table(size_t size_in_mb)
+    explicit table(size_t size_in_mb, bool large_pages = false, size_t num_threads = 1)
+        : m_large_pages{large_pages}
     {
         size_t bytes = size_in_mb * 1024 * 1024;
-        m_size = bytes / sizeof(bucket);
+        allocate(bytes / sizeof(bucket));
 
-        constexpr size_t alignment = 1 << 14;
-        m_buckets = static_cast<bucket *>(std::aligned_alloc(alignment, bytes));
-        assert(m_buckets != nullptr);
-        clear();
+        // pages are untouched until here, so this also spreads first touch across threads
+        clear(num_threads);
     }
 
+    table(const table &) = delete;
+    table &operator=(const table &) = delete;
+
     ~table()
     {
-        std::free(m_buckets);
+        memory::release(m_memory);
     }
 
-    void clear()
+    [[nodiscard]] memory::page_kind page_kind() const
+    {
+        return m_memory.kind;
+    }
+
+    [[nodiscard]] size_t size_in_mb() const
+    {
+        return m_size * sizeof(bucket) / (1024 * 1024);
+    }
+
+    bool save(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+
+        table_file_header header{};
+        std::memcpy(header.magic, TABLE_FILE_MAGIC, sizeof(header.magic));
+        header.version = TABLE_LAYOUT_VERSION;
+        header.bucket_size = sizeof(bucket);
+        header.size = m_size;
+        header.generation = m_generation;
+
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(m_buckets),
+                   static_cast<std::streamsize>(m_size * sizeof(bucket)));
+        return file.good();
+    }
+
+    // replaces the contents, and the size if it differs, with a saved table
+    // the old table is kept as is unless the whole file checks out and reads
+    bool load(const std::string &path)
+    {
+        struct stat st{};
+        if (stat(path.c_str(), &st) == -1 || size_t(st.st_size) < sizeof(table_file_header))
+            return false;
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        table_file_header header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+            return false;
+
+        if (std::memcmp(header.magic, TABLE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != TABLE_LAYOUT_VERSION || header.bucket_size != sizeof(bucket) ||
+            header.size == 0)
+            return false;
+
+        // the size comes from the file, so check it against the length before allocating
+        const size_t payload = size_t(st.st_size) - sizeof(table_file_header);
+        if (payload % sizeof(bucket) != 0 || header.size != payload / sizeof(bucket))
+            return false;
+
+        memory::block old_memory = m_memory;
+        bucket *const old_buckets = m_buckets;
+        const size_t old_size = m_size;
+
+        allocate(header.size);
+        if (!file.read(reinterpret_cast<char *>(m_buckets),
+                       static_cast<std::streamsize>(m_size * sizeof(bucket))))
+        {
+            // never leave a half read table behind
+            memory::release(m_memory);
+            m_memory = old_memory;
+            m_buckets = old_buckets;
+            m_size = old_size;
+            return false;
+        }
+
+        memory::release(old_memory);
+        m_generation = header.generation & AGE_MASK;
+        return true;
+    }
+
+    void clear(size_t num_threads = 1)
     {
         m_generation = 0;
+        parallel_for(num_threads, [this](size_t start, size_t end) { clear_range(start, end); });
+    }
+
+    // reallocates the buckets and keeps as many live entries as fit, search must be stopped
+    void resize(size_t size_in_mb, bool large_pages, size_t num_threads = 1)
+    {
+        memory::block old_memory = m_memory;
+        const bucket *old_buckets = m_buckets;
+        const size_t old_size = m_size;
+
+        m_large_pages = large_pages;
+        allocate(size_in_mb * 1024 * 1024 / sizeof(bucket));
+
+        parallel_for(num_threads, [&](size_t start, size_t end) {
+            migrate_range(old_buckets, old_size, start, end);
+        });
 
-        for (size_t i = 0; i < m_size; ++i)
+        memory::release(old_memory);
+    }
+
+    void clear_range(size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
         {
             m_buckets[i].clear();
         }
@@ -301,4 +533,95 @@ class table
         uint64_t index = (uint128(key) * uint128(m_size)) >> 64;
         __builtin_prefetch(m_buckets + index);
     }
+
+  private:
+    // splits [0, m_size) into one contiguous slice per thread
+    template <typename F> void parallel_for(size_t num_threads, F &&fn)
+    {
+        // not worth spawning threads for small tables
+        constexpr size_t MIN_SLICE = 1 << 16;
+        num_threads = std::clamp(num_threads, size_t{1}, std::max(size_t{1}, m_size / MIN_SLICE));
+        if (num_threads == 1)
+        {
+            fn(0, m_size);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        const size_t slice = (m_size + num_threads - 1) / num_threads;
+        for (size_t i = 0; i < num_threads; ++i)
+        {
+            const size_t start = std::min(m_size, i * slice);
+            const size_t end = std::min(m_size, start + slice);
+            threads.emplace_back([&fn, start, end] { fn(start, end); });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // fills new buckets [start, end) from every old bucket whose hash range overlaps them.
+    // only 16 key bits are stored, which say nothing about the index, so when growing an
+    // entry is copied to each bucket it could now belong to, and those copies are aged by
+    // one generation to be replaced first
+    void migrate_range(const bucket *old_buckets, size_t old_size, size_t start, size_t end)
+    {
+        using uint128 = unsigned __int128;
+
+        for (size_t j = start; j < end; ++j)
+        {
+            bucket &target = m_buckets[j];
+            target.clear();
+
+            int priority[NUM_BUCKETS];
+            std::fill(std::begin(priority), std::end(priority), INT_MIN);
+
+            const size_t first = uint128(j) * old_size / m_size;
+            const size_t last = (uint128(j + 1) * old_size - 1) / m_size;
+            for (size_t i = first; i <= last; ++i)
+            {
+                const bucket &source = old_buckets[i];
+                const bool is_split = uint128(i) * m_size / old_size !=
+                                      (uint128(i + 1) * m_size - 1) / old_size;
+
+                for (int k = 0; k < NUM_BUCKETS; ++k)
+                {
+                    table_entry entry = source.m_entries[k];
+                    if (entry.m_depth + param::DEPTH_OFFSET == param::UNINIT_DEPTH)
+                        continue;
+
+                    int age_diff = (MAX_AGE + m_generation - GET_AGE(entry.m_mask)) & AGE_MASK;
+                    if (is_split && age_diff == 0)
+                    {
+                        age_diff = 1;
+                        entry.m_mask = (entry.m_mask & ~AGE_MASK) |
+                                       SET_AGE((m_generation + MAX_AGE - 1) & AGE_MASK);
+                    }
+
+                    // keep the deepest and most recent, same score as replacement
+                    const int score = entry.m_depth + param::DEPTH_OFFSET - age_diff;
+                    const int slot = std::min_element(std::begin(priority), std::end(priority)) -
+                                     std::begin(priority);
+                    if (score > priority[slot])
+                    {
+                        priority[slot] = score;
+                        target.m_keys[slot] = source.m_keys[k];
+                        target.m_entries[slot] = entry;
+                    }
+                }
+            }
+        }
+    }
+
+    void allocate(size_t num_buckets)
+    {
+        m_size = num_buckets;
+        m_memory = memory::allocate(m_size * sizeof(bucket), m_large_pages);
+        m_buckets = static_cast<bucket *>(m_memory.ptr);
+
+        // every thread probes everywhere, so spread the pages instead of keeping them local
+        if (numa::is_active(global::numa_policy))
+            numa::interleave(m_memory.ptr, m_memory.size);
+        assert(m_buckets != nullptr);
+    }
 };
@@ -15,6 +15,8 @@ struct search_param
     int64_t binc{};
     int32_t depth{};
     int64_t movetime{};
+    // summed over all threads, 0 for no limit
+    uint64_t nodes{};
     int64_t move_overhead{};
     bool ponder = false;
     bool is_main_thread = true;
@@ -52,6 +54,7 @@ struct search_param
         binc = 0;
         depth = param::MAX_DEPTH;
         movetime = param::TIME_MAX;
+        nodes = 0;
         move_overhead = 0;
         ponder = false;
         is_main_thread = true;
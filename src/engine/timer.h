@@ -1,61 +1,86 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 
 class timer
 {
   private:
+    using clock = std::chrono::steady_clock;
+
     // start time
-    std::atomic<std::chrono::milliseconds> m_start{};
+    std::atomic<clock::time_point> m_start{};
 
     // max time
-    std::atomic<std::chrono::milliseconds> m_target{};
+    std::atomic<clock::time_point> m_target{};
 
     // optimal time
-    std::atomic<std::chrono::milliseconds> m_opt_time{};
-    std::atomic<std::chrono::milliseconds> m_opt_time_delta{};
+    std::atomic<clock::time_point> m_opt_time{};
+    std::atomic<clock::duration> m_opt_time_delta{};
 
     std::atomic<bool> m_is_stopped = false;
-    std::atomic<bool> m_forced_stopped = false;
+
+    // raised by [stop] or when any thread passes the deadline, shared by every thread of a
+    // search with [share_stop], otherwise [m_own_stop]
+    std::atomic<bool> m_own_stop = false;
+    std::atomic<bool> *m_stop = &m_own_stop;
+
+    // nodes between deadline checks, picked so a check comes about every CHECK_PERIOD of
+    // search at the speed measured since the last one, slow nodes like deep qsearch or tb
+    // probes then check more often
+    static constexpr std::chrono::microseconds CHECK_PERIOD{100};
+    static constexpr uint64_t MIN_INTERVAL = 16;
+    static constexpr uint64_t MAX_INTERVAL = 4096;
+    uint64_t m_next_check = 0;
+    uint64_t m_last_nodes = 0;
+    clock::time_point m_last_check{};
 
   public:
-    void stop()
+    // [flag] is cleared by its owner before each search
+    void share_stop(std::atomic<bool> *flag)
     {
-        m_forced_stopped.store(true, std::memory_order_relaxed);
+        m_stop = flag;
     }
 
-    void unstop()
+    void stop()
     {
-        m_forced_stopped.store(false, std::memory_order_relaxed);
+        m_stop->store(true, std::memory_order_relaxed);
     }
 
     bool is_opt_time_stop() const
     {
-        return now() >= m_opt_time.load(std::memory_order_relaxed);
+        return clock::now() >= m_opt_time.load(std::memory_order_relaxed);
     }
 
     void start(int64_t ms, int64_t opt_ms)
     {
-        m_start.store(now(), std::memory_order_relaxed);
-        m_target = m_start.load(std::memory_order_relaxed) + std::chrono::milliseconds(ms);
+        const auto start = clock::now();
+        m_start.store(start, std::memory_order_relaxed);
+        m_target = start + std::chrono::milliseconds(ms);
 
-        m_opt_time = m_start.load(std::memory_order_relaxed) + std::chrono::milliseconds(opt_ms);
+        m_opt_time = start + std::chrono::milliseconds(opt_ms);
         m_opt_time_delta = std::chrono::milliseconds(opt_ms);
 
         m_is_stopped.store(false, std::memory_order_relaxed);
-        m_forced_stopped.store(false, std::memory_order_relaxed);
-    }
+        m_own_stop.store(false, std::memory_order_relaxed);
 
-    bool is_force_stopped() const
-    {
-        return m_forced_stopped.load(std::memory_order_relaxed);
+        m_last_check = start;
+        m_last_nodes = 0;
+        m_next_check = MIN_INTERVAL;
     }
 
     bool is_stopped() const
     {
         return m_is_stopped.load(std::memory_order_relaxed) ||
-               m_forced_stopped.load(std::memory_order_relaxed);
+               m_stop->load(std::memory_order_relaxed);
+    }
+
+    // true when [nodes] searched so far is due for a deadline check
+    bool is_check_due(uint64_t nodes) const
+    {
+        return nodes >= m_next_check;
     }
 
     void check()
@@ -63,28 +88,52 @@ class timer
         if (is_stopped())
             return;
 
-        auto current = now();
+        if (clock::now() >= m_target.load(std::memory_order_relaxed))
+        {
+            m_is_stopped.store(true, std::memory_order_relaxed);
+            m_stop->store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // [check] that also spaces the next one by the measured speed
+    void check(uint64_t nodes)
+    {
+        if (is_stopped())
+            return;
+
+        const auto current = clock::now();
         if (current >= m_target.load(std::memory_order_relaxed))
         {
             m_is_stopped.store(true, std::memory_order_relaxed);
+            m_stop->store(true, std::memory_order_relaxed);
+            return;
         }
+
+        const int64_t elapsed = std::max<int64_t>(
+            1, std::chrono::nanoseconds(current - m_last_check).count());
+        const uint64_t interval =
+            (nodes - m_last_nodes) * std::chrono::nanoseconds(CHECK_PERIOD).count() / elapsed;
+
+        m_last_check = current;
+        m_last_nodes = nodes;
+        m_next_check = nodes + std::clamp(interval, MIN_INTERVAL, MAX_INTERVAL);
     }
 
     static std::chrono::milliseconds now()
     {
         return std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now().time_since_epoch());
+            clock::now().time_since_epoch());
     }
 
     void set_mult_optimal(double mult)
     {
         if (is_stopped())
             return;
-        
+
         auto new_opt_time =
             m_start.load(std::memory_order_relaxed) +
-            std::chrono::milliseconds(
-                (long long)(mult * m_opt_time_delta.load(std::memory_order_relaxed).count()));
+            std::chrono::duration_cast<clock::duration>(
+                mult * m_opt_time_delta.load(std::memory_order_relaxed));
         m_opt_time = new_opt_time;
     }
 };
@@ -4,6 +4,7 @@
 #include "../version.h"
 #include "chess960.h"
 #include "lazysmp.h"
+#include <fstream>
 #include <thread>
 
 std::string timestamp()
@@ -67,11 +68,13 @@ class uci_handler
   private:
     chess::Board m_position;
     endgame_table *m_endgame_table = nullptr;
-    nnue2::net *m_nnue = nullptr;
+    nnue2::network_view *m_network = nullptr;
     int m_thread_aff = -1;
     int64_t m_move_overhead = 10;
     search_param m_param{};
     int m_num_threads = 1;
+    size_t m_hash_mb = 128;
+    std::string m_tt_autosave{};
 
     std::unique_ptr<lazysmp> m_engine;
     table *m_tt;
@@ -80,29 +83,47 @@ class uci_handler
   public:
     explicit uci_handler()
     {
-        m_tt = new table{128};
-        m_nnue = new nnue2::net{};
-        m_nnue->incbin_load();
+        // reads the node layout while the affinity is still the one the process started with
+        numa::nodes();
+
+        m_tt = new table{m_hash_mb, global::large_pages};
+        m_network = new nnue2::network_view{};
+        m_network->incbin_load();
         reload_engine();
     }
 
     ~uci_handler()
     {
+        // the threads go first, they point at everything below
+        stop_task();
+        m_engine.reset();
+
         delete m_endgame_table;
-        delete m_nnue;
+        delete m_network;
         delete m_tt;
     }
 
+    // a fresh pool, only needed when threads move between numa nodes, other options re-point
+    // the existing threads
     void reload_engine()
     {
-        m_engine = std::make_unique<lazysmp>(m_num_threads, m_nnue, m_tt, m_endgame_table);
+        m_engine =
+            std::make_unique<lazysmp>(m_num_threads, m_network, m_tt, m_endgame_table);
     }
 
-    void loop(const std::string &variant)
+    void loop(const std::vector<std::string> &args)
     {
         std::ios::sync_with_stdio(false);
         std::cout << std::unitbuf; // auto-flush after each output
 
+        if (args.size() == 3 && args[0] == "evalfile")
+        {
+            evalfile(args[1], args[2]);
+            return;
+        }
+
+        const std::string variant = args.size() == 1 ? args[0] : "";
+
         if (variant == "bench")
         {
             // depth x
@@ -114,6 +135,31 @@ class uci_handler
 
             std::cout << m_engine->get_stats().nodes_searched << " nodes "
                       << m_engine->get_stats().get_nps() << " nps" << std::endl;
+            m_engine->display_footprint();
+            return;
+        }
+
+        if (variant == "latency")
+        {
+            start_latency();
+            return;
+        }
+
+        if (variant == "verify")
+        {
+            verify();
+            return;
+        }
+
+        if (variant == "scaling")
+        {
+            scaling();
+            return;
+        }
+
+        if (variant == "stoplatency")
+        {
+            stop_latency();
             return;
         }
 
@@ -139,10 +185,9 @@ class uci_handler
                 param.movetime = 1000;
                 chess::Board position{positions[i]};
 
-                m_engine = std::make_unique<lazysmp>(4, m_nnue, m_tt, m_endgame_table);
+                m_engine = std::make_unique<lazysmp>(4, m_network, m_tt, m_endgame_table);
                 m_engine->search(position, param, true);
-                m_tt->clear();
-                m_nnue->clear();
+                m_tt->clear(4);
             }
 
             return;
@@ -175,6 +220,7 @@ class uci_handler
 
                 std::cout << "id name TDchess " << version << "\n";
                 std::cout << "id author troppydash\n";
+                std::cout << "info string using " << simd::ISA << " kernels\n";
                 std::cout << "option name SyzygyPath type string default <empty>\n";
                 std::cout << "option name EVALFILE type string default <empty>\n";
                 std::cout << "option name Hash type spin default 128 min 8 max 16384\n";
@@ -184,7 +230,15 @@ class uci_handler
                           << total_threads - 1 << "\n";
                 std::cout << "option name MoveOverhead type spin default 10 min 0 max 2000\n";
                 std::cout << "option name UCI_Chess960 type check default false\n";
+                std::cout << "option name LargePages type check default true\n";
+                std::cout << "option name NumaPolicy type combo default none var none var bind "
+                             "var replicate\n";
+                std::cout << "option name TTAutoSave type string default <empty>\n";
                 std::cout << "option name DrawContempt type spin default 0 min -100 max 100\n";
+                std::cout << "option name LazyEval type check default false\n";
+                std::cout << "option name LazyMargin type spin default 400 min 0 max 2000\n";
+                std::cout << "option name EvalStats type check default false\n";
+                std::cout << "option name ABDADA type check default false\n";
 
 #ifdef TDCHESS_TUNE
                 auto &features = tunable_features_list();
@@ -205,38 +259,70 @@ class uci_handler
             {
                 if (parts[2] == "SyzygyPath")
                 {
+                    stop_task();
+                    m_engine->set_endgame(nullptr);
+
                     delete m_endgame_table;
                     m_endgame_table = new endgame_table{};
                     if (!m_endgame_table->load_file(parts[4]))
                     {
                         delete m_endgame_table;
+                        m_endgame_table = nullptr;
                         std::cout << "info cannot load endgame table\n";
                     }
                     else
                     {
-                        reload_engine();
+                        m_engine->set_endgame(m_endgame_table);
                     }
                 }
                 else if (parts[2] == "EVALFILE")
                 {
-                    delete m_nnue;
-                    m_nnue = new nnue2::net{};
-                    if (!m_nnue->load_network(parts[4]))
+                    auto *network = new nnue2::network_view{};
+                    if (!network->load_network(parts[4]))
                     {
-                        delete m_nnue;
+                        delete network;
                         std::cout << "info cannot load nnue\n";
                     }
                     else
                     {
-                        reload_engine();
+                        // threads still point at the old weights until they are re-pointed
+                        stop_task();
+                        m_engine->set_network(network);
+                        delete m_network;
+                        m_network = network;
+
+                        std::cout << "info string nnue " << m_network->dimensions() << std::endl;
                     }
                 }
                 else if (parts[2] == "Hash")
                 {
-                    size_t tt_size = parse_i32(parts[4]);
-                    delete m_tt;
-                    m_tt = new table{tt_size};
+                    m_hash_mb = parse_i32(parts[4]);
+                    reload_table();
+                }
+                else if (parts[2] == "LargePages")
+                {
+                    global::large_pages = parts[4] == "true";
+                    reload_table();
+                }
+                else if (parts[2] == "NumaPolicy")
+                {
+                    if (!numa::parse_policy(parts[4], global::numa_policy))
+                    {
+                        std::cout << "info string unknown numa policy " << parts[4] << "\n";
+                        continue;
+                    }
+
+                    // the tt is reinterleaved, threads rebuild their state on their nodes
+                    reload_table();
                     reload_engine();
+                    std::cout << "info string numa " << numa::policy_name(global::numa_policy)
+                              << " over " << numa::node_count() << " node(s)"
+                              << (numa::is_active(global::numa_policy) ? "" : ", inactive")
+                              << "\n";
+                }
+                else if (parts[2] == "TTAutoSave")
+                {
+                    m_tt_autosave = parts.size() > 4 && parts[4] != "<empty>" ? parts[4] : "";
                 }
                 else if (parts[2] == "CoreAff")
                 {
@@ -249,7 +335,8 @@ class uci_handler
                 else if (parts[2] == "Threads")
                 {
                     m_num_threads = parse_i64(parts[4]);
-                    reload_engine();
+                    stop_task();
+                    m_engine->resize(m_num_threads);
                 }
                 else if (parts[2] == "UCI_Chess960")
                 {
@@ -258,6 +345,24 @@ class uci_handler
                 else if (parts[2] == "DrawContempt")
                 {
                     global::contempt = parse_i32(parts[4]);
+                    stop_task();
+                    m_engine->run_all([](auto &t) { t.eng->compute_contempt(); });
+                }
+                else if (parts[2] == "LazyEval")
+                {
+                    global::lazy_eval = parts[4] == "true";
+                }
+                else if (parts[2] == "LazyMargin")
+                {
+                    global::lazy_margin = parse_i32(parts[4]);
+                }
+                else if (parts[2] == "EvalStats")
+                {
+                    global::eval_stats = parts[4] == "true";
+                }
+                else if (parts[2] == "ABDADA")
+                {
+                    global::abdada = parts[4] == "true";
                 }
                 else
                 {
@@ -326,14 +431,62 @@ class uci_handler
                 // to reset time calculations
                 m_param.reset();
 
-                // to reset tt to empty
-                m_tt->clear();
+                // the tt and every thread's tables are cleared by the threads at once
+                m_engine->new_game();
+            }
+            else if (lead == "tt")
+            {
+                if (parts.size() == 2 && parts[1] == "stats")
+                {
+#ifdef TDCHESS_TT_STATS
+                    m_engine->last_stats.tt.display();
+#else
+                    std::cout << "info string tt stats not compiled in, build with "
+                                 "TDCHESS_TT_STATS\n";
+#endif
+                    continue;
+                }
 
-                // also reset nnue
-                m_nnue->clear();
+                if (parts.size() < 3)
+                {
+                    std::cout << "warning usage tt stats|save <file>|load <file>\n";
+                    continue;
+                }
 
-                // reload lazysmp just in case
-                reload_engine();
+                stop_task();
+                if (parts[1] == "save")
+                {
+                    bool ok = m_tt->save(parts[2]);
+                    std::cout << "info string tt save " << (ok ? "done" : "failed") << "\n";
+                }
+                else if (parts[1] == "load")
+                {
+                    bool ok = m_tt->load(parts[2]);
+                    m_hash_mb = m_tt->size_in_mb();
+                    std::cout << "info string tt load " << (ok ? "done" : "failed") << ", hash "
+                              << m_hash_mb << " MB\n";
+                }
+                else
+                {
+                    std::cout << "warning unknown tt command\n";
+                }
+            }
+            else if (lead == "convert")
+            {
+                // converts a network in the old int16 layout to the int8 format
+                if (parts.size() < 3)
+                {
+                    std::cout << "warning usage convert <in.bin> <out.bin>\n";
+                    continue;
+                }
+
+                nnue2::network_view network{};
+                bool ok = network.load_network(parts[1]) && network.save(parts[2]);
+                std::cout << "info string convert " << (ok ? "done" : "failed") << "\n";
+            }
+            else if (lead == "footprint")
+            {
+                m_engine->display_footprint();
             }
             else if (lead == "isready")
             {
@@ -362,6 +515,11 @@ class uci_handler
                         m_param.movetime = parse_i64(parts[i + 1]);
                         i += 1;
                     }
+                    else if (parts[i] == "nodes")
+                    {
+                        m_param.nodes = std::max<int64_t>(0, parse_i64(parts[i + 1]));
+                        i += 1;
+                    }
                     else if (parts[i] == "wtime")
                     {
                         m_param.wtime = parse_i64(parts[i + 1]);
@@ -448,9 +606,466 @@ class uci_handler
         }
 
         stop_task();
+
+        if (!m_tt_autosave.empty() && !m_tt->save(m_tt_autosave))
+            std::cout << "info string tt autosave failed\n";
+    }
+
+    // static evaluation of every position in an epd file, written as "<epd> <cp>" lines in the
+    // same order, the score is from the side to move, split over all cores
+    void evalfile(const std::string &in_path, const std::string &out_path)
+    {
+        std::ifstream in{in_path};
+        std::ofstream out{out_path};
+        if (!in.is_open() || !out.is_open())
+        {
+            std::cout << "info string evalfile cannot open " << in_path << " or " << out_path
+                      << "\n";
+            return;
+        }
+
+        // lines read and scored at a time, and positions per evaluate_batch call
+        constexpr size_t CHUNK = 1 << 20;
+        constexpr size_t BATCH = 256;
+
+        const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<memory::large_ptr<nnue2::net>> nets{};
+        for (size_t t = 0; t < num_threads; ++t)
+            nets.push_back(m_network->make_net(m_network->get(), global::large_pages));
+
+        std::vector<std::string> lines{};
+        std::vector<int32_t> scores{};
+        std::vector<char> valid{};
+        size_t total = 0;
+        size_t skipped = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        while (true)
+        {
+            lines.clear();
+            std::string line;
+            while (lines.size() < CHUNK && std::getline(in, line))
+            {
+                // the position is the first four fields, opcodes are dropped
+                auto parts = helper::string_split(line);
+                if (parts.size() < 4)
+                    continue;
+
+                lines.push_back(parts[0] + " " + parts[1] + " " + parts[2] + " " + parts[3]);
+            }
+
+            if (lines.empty())
+                break;
+
+            scores.assign(lines.size(), 0);
+            valid.assign(lines.size(), 0);
+
+            std::vector<std::thread> workers{};
+            const size_t per_thread = (lines.size() + num_threads - 1) / num_threads;
+            for (size_t t = 0; t < num_threads; ++t)
+            {
+                const size_t lo = std::min(lines.size(), t * per_thread);
+                const size_t hi = std::min(lines.size(), lo + per_thread);
+                workers.emplace_back([&, lo, hi, t]() {
+                    std::vector<chess::Board> boards(BATCH);
+                    std::vector<size_t> index{};
+                    std::vector<int32_t> results(BATCH);
+
+                    for (size_t i = lo; i < hi;)
+                    {
+                        index.clear();
+                        for (; i < hi && index.size() < BATCH; ++i)
+                        {
+                            if (!boards[index.size()].setFen(lines[i]))
+                                continue;
+
+                            index.push_back(i);
+                        }
+
+                        nets[t]->evaluate_batch({boards.data(), index.size()}, results);
+                        for (size_t j = 0; j < index.size(); ++j)
+                        {
+                            scores[index[j]] = results[j];
+                            valid[index[j]] = 1;
+                        }
+                    }
+                });
+            }
+
+            for (auto &worker : workers)
+                worker.join();
+
+            for (size_t i = 0; i < lines.size(); ++i)
+            {
+                if (!valid[i])
+                {
+                    skipped++;
+                    continue;
+                }
+
+                out << lines[i] << " " << scores[i] << "\n";
+            }
+            total += lines.size();
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        std::cout << "info string evalfile " << total - skipped << " positions";
+        if (skipped > 0)
+            std::cout << " (" << skipped << " skipped)";
+        std::cout << " in " << elapsed << " ms, "
+                  << (total - skipped) * 1000 / std::max<int64_t>(elapsed, 1) << " positions/s"
+                  << " on " << num_threads << " threads\n";
+    }
+
+    // how long a go takes to reach the search on every thread, for doubling thread counts up to
+    // the hardware's, short searches back to back like a fast game
+    void start_latency()
+    {
+        const int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+        const int ROUNDS = 200;
+
+        search_param param{};
+        param.depth = 1;
+        chess::Board position{};
+
+        for (int threads = 1;; threads = std::min(threads * 2, max_threads))
+        {
+            m_engine->resize(threads);
+
+            double mean = 0;
+            double worst = 0;
+            double total = 0;
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                m_engine->search(position, param, false);
+                total += std::chrono::duration<double, std::micro>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+                mean += m_engine->last_start_mean / ROUNDS;
+                worst = std::max(worst, m_engine->last_start_worst);
+            }
+
+            std::cout << std::fixed << std::setprecision(1) << "info string threads " << threads
+                      << " start mean " << mean << " us worst " << worst << " us go "
+                      << total / ROUNDS << " us\n";
+
+            if (threads == max_threads)
+                break;
+        }
+
+        m_engine->resize(m_num_threads);
+    }
+
+    // compares incremental evaluation against evaluation from scratch where the two can drift,
+    // the simd kernels against their scalar versions, and lazy evaluation against none
+    void verify()
+    {
+        using layered = nnue2::layered_shape;
+        bool ok = verify_ring();
+        ok = verify_sparse<2 * layered::HL / 4, layered::L2>() && ok;
+        ok = verify_sparse<768, 32>() && ok;
+        ok = verify_lazy() && ok;
+        std::cout << "info string verify " << (ok ? "ok" : "failed") << "\n";
+    }
+
+    // a deep line that never evaluates reuses the root's ring slot, the next line from the root
+    // must not catch up from it
+    bool verify_ring()
+    {
+        const auto nnue = m_network->make_net(m_network->get(), false);
+        const auto fresh_nnue = m_network->make_net(m_network->get(), false);
+        auto chessmap = std::make_unique<chessmap::net>();
+        auto fresh_chessmap = std::make_unique<chessmap::net>();
+
+        chess::Board position{};
+        nnue->initialize(position);
+        chessmap->initialize(position);
+
+        std::vector<chess::Move> line{};
+        for (int ply = 0; ply < 2 * kernels::RING; ++ply)
+        {
+            chess::Movelist moves;
+            chess::movegen::legalmoves(moves, position);
+            if (moves.empty())
+                break;
+
+            const chess::Move move = moves[(ply * 7) % moves.size()];
+            nnue->make_move(position, move);
+            chessmap->make_move(position, move);
+            position.makeMove(move);
+            line.push_back(move);
+        }
+
+        nnue->evaluate(position);
+        chessmap->evaluate_all(position);
+
+        for (auto it = line.rbegin(); it != line.rend(); ++it)
+        {
+            position.unmakeMove(*it);
+            nnue->unmake_move();
+            chessmap->unmake_move();
+        }
+
+        chess::Movelist moves;
+        chess::movegen::legalmoves(moves, position);
+        const chess::Move other = moves[0] != line[0] ? moves[0] : moves[1];
+        nnue->make_move(position, other);
+        chessmap->make_move(position, other);
+        position.makeMove(other);
+
+        fresh_nnue->initialize(position);
+        fresh_chessmap->initialize(position);
+
+        const int32_t incremental = nnue->evaluate(position);
+        const int32_t expected = fresh_nnue->evaluate(position);
+        bool ok = incremental == expected;
+        std::cout << "info string verify ring nnue " << incremental << " expected " << expected
+                  << (ok ? " ok" : " failed") << "\n";
+
+        chessmap->evaluate_all(position);
+        fresh_chessmap->evaluate_all(position);
+        int mismatches = 0;
+        chess::movegen::legalmoves(moves, position);
+        for (const auto &move : moves)
+            mismatches += chessmap->get_output(position, move) !=
+                          fresh_chessmap->get_output(position, move);
+        std::cout << "info string verify ring chessmap " << mismatches << " of " << moves.size()
+                  << " outputs differ" << (mismatches == 0 ? " ok" : " failed") << "\n";
+
+        return ok && mismatches == 0;
+    }
+
+    // the sparse first layer kernels against their scalar versions, on random activations
+    // from all zero to all non-zero
+    template <size_t Blocks, size_t Outputs> bool verify_sparse()
+    {
+        std::mt19937 rng{1};
+        std::uniform_int_distribution<int> byte{0, 255};
+
+        alignas(64) static int8_t weights[Blocks * Outputs * 4];
+        alignas(64) int32_t bias[Outputs];
+        for (auto &w : weights)
+            w = static_cast<int8_t>(byte(rng) - 128);
+        for (auto &b : bias)
+            b = 64 * (byte(rng) - 128);
+
+        int failures = 0;
+        for (int density : {0, 2, 10, 50, 100})
+        {
+            alignas(64) int32_t in[Blocks];
+            auto *in_bytes = reinterpret_cast<uint8_t *>(in);
+            for (size_t i = 0; i < 4 * Blocks; ++i)
+                in_bytes[i] = byte(rng) % 100 < density ? byte(rng) % (nnue2::LAYER_QA + 1) : 0;
+
+            alignas(64) uint16_t nnz[Blocks];
+            alignas(64) uint16_t expected_nnz[Blocks];
+            const int count = kernels::find_nnz<Blocks>(in, nnz);
+            const int expected_count = kernels::find_nnz_scalar<Blocks>(in, expected_nnz);
+            bool ok = count == expected_count && std::equal(nnz, nnz + count, expected_nnz);
+
+            alignas(64) int32_t out[Outputs];
+            alignas(64) int32_t expected[Outputs];
+            kernels::sparse_affine<Outputs>(in, expected_nnz, expected_count, weights, bias, out);
+            kernels::sparse_affine_scalar<Outputs>(in, expected_nnz, expected_count, weights,
+                                                   bias, expected);
+            ok = ok && std::equal(out, out + Outputs, expected);
+
+            failures += !ok;
+        }
+
+        std::cout << "info string verify sparse " << Blocks << " blocks " << Outputs
+                  << " outputs " << failures << " of 5 densities differ"
+                  << (failures == 0 ? " ok" : " failed") << "\n";
+        return failures == 0;
+    }
+
+    // a qsearch that stands pat on pesto stores nothing, so a later qsearch of the same
+    // position without lazy evaluation scores as it would on an empty table
+    bool verify_lazy()
+    {
+        const chess::Board position{"rnb1kbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 3"};
+        const bool lazy_eval = global::lazy_eval;
+        const auto nnue = m_network->make_net(m_network->get(), false);
+
+        // the non lazy qsearch of [position] at a window the pesto score clears by the margin,
+        // after a lazy one when [lazy_first]
+        int skips = 0;
+        bool stored = false;
+        const auto run = [&](bool lazy_first) {
+            table tt{1};
+            engine search{nullptr, nnue.get(), &tt};
+            search.m_position = position;
+            search.begin();
+            search.m_timer.start(INT32_MAX, INT32_MAX);
+
+            search_stack *ss = &search.m_stack[engine::SEARCH_STACK_PREFIX];
+            const int16_t beta = static_cast<int16_t>(
+                search.m_pesto.evaluate(position.sideToMove()) - global::lazy_margin);
+
+            if (lazy_first)
+            {
+                global::lazy_eval = true;
+                search.qsearch<false>(beta - 1, beta, 0, ss);
+                skips = search.m_stats.lazy_skips;
+
+                const uint64_t key =
+                    position.hash() ^ util::ZOBRIST_50MR[position.halfMoveClock()];
+                tt.probe(key).probe(key, stored, tt.m_generation);
+            }
+
+            global::lazy_eval = false;
+            return search.qsearch<false>(beta - 1, beta, 0, ss);
+        };
+
+        const int16_t expected = run(false);
+        const int16_t score = run(true);
+        global::lazy_eval = lazy_eval;
+
+        const bool ok = skips == 1 && !stored && score == expected;
+        std::cout << "info string verify lazy skips " << skips << (stored ? " stored" : "")
+                  << " score " << score << " expected " << expected << (ok ? " ok" : " failed")
+                  << "\n";
+        return ok;
+    }
+
+    // time to a fixed depth from a new game for doubling thread counts up to the hardware's,
+    // without and with abdada, speedup is against one thread of the same kind
+    void scaling()
+    {
+        const std::vector<std::string> fens{
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+            "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        };
+        const int DEPTH = 16;
+        const int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+        const bool abdada = global::abdada;
+
+        search_param param{};
+        param.depth = DEPTH;
+
+        for (bool use_abdada : {false, true})
+        {
+            global::abdada = use_abdada;
+
+            double base = 0;
+            for (int threads = 1;; threads = std::min(threads * 2, max_threads))
+            {
+                m_engine->resize(threads);
+
+                double elapsed = 0;
+                uint64_t nodes = 0;
+                for (const auto &fen : fens)
+                {
+                    m_engine->new_game();
+
+                    const auto start = std::chrono::steady_clock::now();
+                    m_engine->search(chess::Board{fen}, param, false);
+                    elapsed += std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+                    nodes += m_engine->last_stats.nodes_searched;
+                }
+
+                if (threads == 1)
+                    base = elapsed;
+
+                std::cout << std::fixed << std::setprecision(2) << "info string abdada "
+                          << (use_abdada ? "on" : "off") << " threads " << threads << " depth "
+                          << DEPTH << " time " << elapsed << " ms nodes " << nodes << " speedup "
+                          << base / elapsed << "\n";
+
+                if (threads == max_threads)
+                    break;
+            }
+        }
+
+        global::abdada = abdada;
+        m_engine->resize(m_num_threads);
+    }
+
+    // how far searches run past their movetime, and how long a stop takes to end a search,
+    // worst over many searches on the current thread count
+    void stop_latency()
+    {
+        const std::vector<std::string> fens{
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+            "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        };
+        const int ROUNDS = 30;
+        const int64_t MOVETIME = 20;
+
+        using clock = std::chrono::steady_clock;
+        const auto micros = [](clock::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count();
+        };
+
+        std::mt19937 rng{1};
+        std::uniform_int_distribution<int> delay{5, 30};
+
+        double overshoot_mean = 0, overshoot_worst = 0;
+        double stop_mean = 0, stop_worst = 0;
+        for (const auto &fen : fens)
+        {
+            const chess::Board position{fen};
+
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                search_param param{};
+                param.movetime = MOVETIME;
+
+                const auto start = clock::now();
+                m_engine->search(position, param, false);
+                const double over =
+                    micros(clock::now() - start - std::chrono::milliseconds(MOVETIME));
+
+                overshoot_mean += over / (ROUNDS * fens.size());
+                overshoot_worst = std::max(overshoot_worst, over);
+            }
+
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                clock::time_point done{};
+                std::thread searcher{[&]() {
+                    search_param param{};
+                    m_engine->search(position, param, false);
+                    done = clock::now();
+                }};
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay(rng)));
+                const auto stopped = clock::now();
+                m_engine->stop();
+                searcher.join();
+
+                const double latency = micros(done - stopped);
+                stop_mean += latency / (ROUNDS * fens.size());
+                stop_worst = std::max(stop_worst, latency);
+            }
+        }
+
+        std::cout << std::fixed << std::setprecision(1) << "info string threads " << m_num_threads
+                  << " movetime overshoot mean " << overshoot_mean << " us worst "
+                  << overshoot_worst << " us\n"
+                  << "info string threads " << m_num_threads << " stop latency mean " << stop_mean
+                  << " us worst " << stop_worst << " us\n";
     }
 
   private:
+    void reload_table()
+    {
+        // keeps the contents, the search threads keep pointing at the same table
+        stop_task();
+        m_tt->resize(m_hash_mb, global::large_pages, m_num_threads);
+
+        std::cout << "info string hash " << m_hash_mb << " MB using "
+                  << memory::page_kind_name(m_tt->page_kind()) << "\n";
+    }
+
     void start_task(const std::function<void()> &task)
     {
         stop_task();
@@ -5,14 +5,10 @@
 #ifdef TDCHESS_UCI
 int main(int argc, char **argv)
 {
-    std::string variant{};
-    if (argc == 2)
-    {
-        variant = argv[1];
-    }
+    std::vector<std::string> args{argv + 1, argv + argc};
 
     uci_handler handler{};
-    handler.loop(variant);
+    handler.loop(args);
 
     return 0;
 }
@@ -177,8 +173,8 @@ void position_test()
     endgame_table m_table{};
     m_table.load_file("/Users/troppydash/Downloads/syzygy");
 
-    auto *nnue = new nnue2::net{};
-    nnue->incbin_load();
+    nnue2::network_view network{};
+    network.incbin_load();
     table tt{512};
 
     // for (auto &[pos, target] : positions)
@@ -199,7 +195,7 @@ void position_test()
     {
         tt.clear();
 
-        lazysmp engine{1, nnue, &tt, &m_table};
+        lazysmp engine{1, &network, &tt, &m_table};
 
         chess::Board start{pos};
         search_param param;
@@ -209,7 +205,6 @@ void position_test()
         std::cout << "oracle " << target << std::endl;
     }
 
-    delete nnue;
 }
 
 int main()